@@ -0,0 +1,590 @@
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <glwx/transform.hpp>
+
+#include "../classic-ecs/ecs.hpp"
+#include "shared.hpp"
+#include "thread_pool.hpp"
+
+// Micro benchmarks for the ECS in classic-ecs/ecs.hpp. This is built once for every storage backend
+// (gac-bench-ecs and gac-bench-ecs-archetype) and prints the results as JSON. The systems are
+// copies of the ones in classic-ecs/game.cpp.
+
+namespace {
+#ifdef ECS_ARCHETYPE_STORAGE
+constexpr auto storage_name = "archetype";
+#else
+constexpr auto storage_name = "pool";
+#endif
+
+struct Transform {
+    glwx::Transform value;
+};
+
+struct Velocity {
+    glm::vec3 value = glm::vec3(0.0f);
+};
+
+struct Asteroid {
+    float radius;
+};
+
+struct Bullet { };
+
+struct Debris { };
+
+struct Collider {
+    float radius;
+};
+
+using Components = ecs::ComponentList<Transform, Velocity, Asteroid, Bullet, Debris, Collider>;
+}
+
+ECS_COMPONENT_LIST(Components);
+
+namespace {
+struct Options {
+    usize entities = 100'000;
+    usize asteroids = 1000;
+    usize bullets = 100;
+    usize iterations = 50;
+    // The parallel physics system runs with 1, 2, 4, ... up to this many threads
+    usize threads = std::max(std::thread::hardware_concurrency(), 1u);
+    // Number of entity creates and destroys
+    usize churn_ops = 1'000'000;
+    // Number of bullets created at once by spawn
+    usize burst = 1000;
+    // The broadphase runs with 1000, 10000, ... up to this many colliders
+    usize max_colliders = 100'000;
+};
+
+void wrap_position(glwx::Transform& transform, const glm::vec3& velocity, float dt)
+{
+    auto pos = transform.getPosition() + velocity * dt;
+    if (pos.x < -view_bounds_size.x * 0.5f) {
+        pos.x += view_bounds_size.x;
+    }
+    if (pos.x > view_bounds_size.x * 0.5f) {
+        pos.x -= view_bounds_size.x;
+    }
+    if (pos.z < -view_bounds_size.y * 0.5f) {
+        pos.z += view_bounds_size.y;
+    }
+    if (pos.z > view_bounds_size.y * 0.5f) {
+        pos.z -= view_bounds_size.y;
+    }
+    transform.setPosition(pos);
+}
+
+void physics_get(float dt)
+{
+    ecs::for_each<Transform, Velocity>([dt](ecs::Entity entity) {
+        auto& transform = ecs::get<Transform>(entity);
+        auto& velocity = ecs::get<Velocity>(entity);
+        wrap_position(transform.value, velocity.value, dt);
+    });
+}
+
+void physics_typed(float dt)
+{
+    ecs::for_each<Transform, Velocity>([dt](ecs::Entity, Transform& transform, Velocity& velocity) {
+        wrap_position(transform.value, velocity.value, dt);
+    });
+}
+
+void physics_parallel(ThreadPool& pool, float dt)
+{
+    ecs::parallel_for_each<Transform, const Velocity>(
+        [dt](ecs::Entity, Transform& transform, const Velocity& velocity) {
+            wrap_position(transform.value, velocity.value, dt);
+        },
+        pool);
+}
+
+void collide_asteroids_get()
+{
+    ecs::for_each<Transform, Velocity, Asteroid>([&](ecs::Entity a) {
+        auto& a_trafo = ecs::get<Transform>(a).value;
+        auto& a_velocity = ecs::get<Velocity>(a).value;
+        const auto a_radius = ecs::get<Asteroid>(a).radius;
+        ecs::for_each<Transform, Velocity, Asteroid>([&](ecs::Entity b) {
+            if (a == b) {
+                return;
+            }
+
+            auto& b_trafo = ecs::get<Transform>(b).value;
+            auto& b_velocity = ecs::get<Velocity>(b).value;
+            const auto b_radius = ecs::get<Asteroid>(b).radius;
+
+            const auto rel = b_trafo.getPosition() - a_trafo.getPosition();
+            if (glm::dot(rel, rel) < (a_radius + b_radius) * (a_radius + b_radius)) {
+                collide_spheres(a_trafo, a_velocity, a_radius, b_trafo, b_velocity, b_radius);
+            }
+        });
+    });
+}
+
+void collide_asteroids_typed()
+{
+    ecs::for_each<Transform, Velocity, Asteroid>(
+        [&](ecs::Entity a, Transform& a_trafo, Velocity& a_velocity, Asteroid& a_asteroid) {
+            const auto a_radius = a_asteroid.radius;
+            ecs::for_each<Transform, Velocity, Asteroid>(
+                [&](ecs::Entity b, Transform& b_trafo, Velocity& b_velocity, Asteroid& b_asteroid) {
+                    if (a == b) {
+                        return;
+                    }
+
+                    const auto b_radius = b_asteroid.radius;
+                    const auto rel = b_trafo.value.getPosition() - a_trafo.value.getPosition();
+                    if (glm::dot(rel, rel) < (a_radius + b_radius) * (a_radius + b_radius)) {
+                        collide_spheres(a_trafo.value, a_velocity.value, a_radius, b_trafo.value,
+                            b_velocity.value, b_radius);
+                    }
+                });
+        });
+}
+
+// The hit test of sys_shoot_asteroids, without destroying anything
+usize num_hits = 0;
+
+void shoot_asteroids_get()
+{
+    constexpr auto bullet_radius = 1.0f;
+    usize hits = 0;
+    ecs::for_each<Transform, Velocity, Bullet>([&](ecs::Entity bullet) {
+        const auto bullet_pos = ecs::get<Transform>(bullet).value.getPosition();
+        ecs::for_each<Transform, Velocity, Asteroid>([&](ecs::Entity asteroid) {
+            const auto rel = ecs::get<Transform>(asteroid).value.getPosition() - bullet_pos;
+            const auto total_radius = ecs::get<Asteroid>(asteroid).radius + bullet_radius;
+            if (glm::dot(rel, rel) < total_radius * total_radius) {
+                hits++;
+            }
+        });
+    });
+    num_hits = hits;
+}
+
+void shoot_asteroids_typed()
+{
+    constexpr auto bullet_radius = 1.0f;
+    usize hits = 0;
+    ecs::for_each<Transform, Velocity, Bullet>(
+        [&](ecs::Entity, Transform& bullet_trafo, Velocity&, Bullet&) {
+            const auto bullet_pos = bullet_trafo.value.getPosition();
+            ecs::for_each<Transform, Velocity, Asteroid>(
+                [&](ecs::Entity, Transform& trafo, Velocity&, Asteroid& asteroid) {
+                    const auto rel = trafo.value.getPosition() - bullet_pos;
+                    const auto total_radius = asteroid.radius + bullet_radius;
+                    if (glm::dot(rel, rel) < total_radius * total_radius) {
+                        hits++;
+                    }
+                });
+        });
+    num_hits = hits;
+}
+
+// Creates and destroys entities in random order, like bullets and asteroids do, with up to 10000
+// of them alive at a time (on top of the ones from create_entities). Returns nanoseconds per op.
+double entity_churn(usize ops)
+{
+    constexpr usize max_alive = 10'000;
+    std::vector<u32> random(ops);
+    for (auto& r : random) {
+        r = static_cast<u32>(randi(0, std::numeric_limits<int>::max()));
+    }
+    std::vector<ecs::Entity> alive;
+    alive.reserve(max_alive);
+
+    const auto start = get_time_ns();
+    for (const auto r : random) {
+        if (alive.empty() || (alive.size() < max_alive && (r & 1))) {
+            alive.push_back(ecs::create());
+        } else {
+            const auto i = (r >> 1) % alive.size();
+            ecs::destroy(alive[i]);
+            alive[i] = alive.back();
+            alive.pop_back();
+        }
+    }
+    const auto ns = get_time_ns() - start;
+
+    for (const auto entity : alive) {
+        ecs::destroy(entity);
+    }
+    return static_cast<double>(ns) / static_cast<double>(std::max<usize>(ops, 1));
+}
+
+// Asteroids are spread over the whole field, followed by the bullets. Everything else is debris,
+// which is only moved by sys_physics.
+std::vector<ecs::Entity> create_entities(const Options& options)
+{
+    std::vector<ecs::Entity> entities;
+    for (usize i = 0; i < options.entities; ++i) {
+        const auto entity = ecs::create();
+        auto& trafo = ecs::add<Transform>(entity).value;
+        trafo.setPosition(glm::vec3(randf(-0.5f, 0.5f) * view_bounds_size.x, 0.0f,
+            randf(-0.5f, 0.5f) * view_bounds_size.y));
+        const auto angle = randf(0.0f, glm::pi<float>() * 2.0f);
+        ecs::add<Velocity>(entity, glm::vec3(glm::cos(angle), 0.0f, glm::sin(angle)));
+        if (i < options.asteroids) {
+            ecs::add<Asteroid>(entity, randf(0.5f, 2.5f));
+        } else if (i < options.asteroids + options.bullets) {
+            ecs::add<Bullet>(entity);
+        } else {
+            ecs::add<Debris>(entity);
+        }
+        entities.push_back(entity);
+    }
+    return entities;
+}
+
+struct Comparison {
+    u64 get_ns;
+    u64 typed_ns;
+};
+
+// Median nanoseconds per call. The calls alternate, so both are affected by noise (and the state
+// of the simulation) the same way.
+template <typename GetFunc, typename TypedFunc>
+Comparison compare(usize iterations, GetFunc get_func, TypedFunc typed_func)
+{
+    get_func(); // warm up
+    typed_func();
+    std::vector<u64> get_times, typed_times;
+    for (usize i = 0; i < iterations; ++i) {
+        const auto start = get_time_ns();
+        get_func();
+        const auto mid = get_time_ns();
+        typed_func();
+        get_times.push_back(mid - start);
+        typed_times.push_back(get_time_ns() - mid);
+    }
+    std::sort(get_times.begin(), get_times.end());
+    std::sort(typed_times.begin(), typed_times.end());
+    return Comparison { get_times[iterations / 2], typed_times[iterations / 2] };
+}
+
+// Median nanoseconds per call
+template <typename Func>
+u64 measure(usize iterations, Func func, bool warm_up = true)
+{
+    if (warm_up) {
+        func(); // and start the threads
+    }
+    std::vector<u64> times;
+    for (usize i = 0; i < iterations; ++i) {
+        const auto start = get_time_ns();
+        func();
+        times.push_back(get_time_ns() - start);
+    }
+    std::sort(times.begin(), times.end());
+    return times[iterations / 2];
+}
+
+struct ChangeDetection {
+    u64 all_ns;
+    u64 none_changed_ns;
+    u64 some_changed_ns;
+};
+
+// The sum of the positions read by change_detection
+glm::vec3 position_sum(0.0f);
+
+// Something like a render cache, which only needs the transforms that changed since the last
+// frame: reading every transform compared to a Changed filter when none of them changed and when
+// every 100th one changed
+ChangeDetection change_detection(const std::vector<ecs::Entity>& entities, usize iterations)
+{
+    const auto read = [](ecs::Entity, const Transform& transform) {
+        position_sum += transform.value.getPosition();
+    };
+    ChangeDetection result;
+    result.all_ns = measure(iterations, [&] { ecs::for_each<const Transform>(read); });
+    ecs::Tick last_run = 0;
+    result.none_changed_ns = measure(iterations,
+        [&] { ecs::for_each<const Transform>(ecs::Changed<Transform>(last_run), read); });
+    result.some_changed_ns = measure(iterations, [&] {
+        for (usize i = 0; i < entities.size(); i += 100) {
+            ecs::mark_changed<Transform>(entities[i]);
+        }
+        ecs::for_each<const Transform>(ecs::Changed<Transform>(last_run), read);
+    });
+    return result;
+}
+
+struct Spawn {
+    u64 add_ns;
+    u64 instantiate_ns;
+};
+
+// Median nanoseconds to create a burst of bullets by adding their components one by one and by
+// instantiating a prefab. The bullets are destroyed after every iteration (not measured).
+Spawn spawn(usize burst, usize iterations)
+{
+    ecs::Prefab prefab;
+    prefab.add<Transform>();
+    prefab.add<Velocity>(glm::vec3(0.0f, 0.0f, 20.0f));
+    prefab.add<Bullet>();
+    std::vector<ecs::Entity> bullets;
+    const auto measure_burst = [&](auto create) {
+        std::vector<u64> times;
+        for (usize i = 0; i <= iterations; ++i) { // The first one is a warm up
+            const auto start = get_time_ns();
+            create();
+            times.push_back(get_time_ns() - start);
+            for (const auto bullet : bullets) {
+                ecs::destroy(bullet);
+            }
+            bullets.clear();
+        }
+        std::sort(times.begin() + 1, times.end());
+        return times[1 + iterations / 2];
+    };
+    Spawn result;
+    result.add_ns = measure_burst([&] {
+        for (usize i = 0; i < burst; ++i) {
+            const auto bullet = ecs::create();
+            ecs::add<Transform>(bullet);
+            ecs::add<Velocity>(bullet, glm::vec3(0.0f, 0.0f, 20.0f));
+            ecs::add<Bullet>(bullet);
+            bullets.push_back(bullet);
+        }
+    });
+    result.instantiate_ns = measure_burst([&] { bullets = ecs::instantiate(prefab, burst); });
+    return result;
+}
+
+struct Snapshots {
+    usize bytes;
+    usize compressed_bytes;
+    u64 snapshot_ns;
+    u64 restore_ns;
+    u64 compressed_snapshot_ns;
+    u64 compressed_restore_ns;
+};
+
+// Saving the whole world and restoring it (e.g. for rollback), raw and compressed
+Snapshots snapshots(usize iterations)
+{
+    Snapshots result;
+    std::vector<std::byte> data;
+    result.snapshot_ns = measure(iterations, [&] { data = ecs::snapshot(); });
+    result.bytes = data.size();
+    result.restore_ns = measure(iterations, [&] { ecs::restore(data); });
+    result.compressed_snapshot_ns = measure(iterations, [&] { data = ecs::snapshot(true); });
+    result.compressed_bytes = data.size();
+    result.compressed_restore_ns = measure(iterations, [&] { ecs::restore(data); });
+    return result;
+}
+
+struct Broadphase {
+    usize colliders;
+    usize pairs;
+    u64 all_pairs_ns;
+    u64 grid_ns;
+};
+
+// Finding the overlapping colliders (like sys_collision in hybrid/game.cpp) by testing every pair
+// and with the grid of for_each_pair with a Space. The space grows with the number of colliders,
+// so there are always 100 of them per view_bounds_size and about as many overlaps per collider.
+// Testing every pair of 100k colliders takes a minute, so it runs less often (and without a warm
+// up if only once) the more there are.
+std::vector<Broadphase> broadphase(const Options& options)
+{
+    std::vector<Broadphase> results;
+    for (usize colliders = 1000; colliders <= options.max_colliders; colliders *= 10) {
+        const auto scale = std::sqrt(static_cast<float>(colliders) / 100.0f);
+        const ecs::Space space { view_bounds_size.x * scale, view_bounds_size.y * scale };
+        ecs::World world(colliders);
+        for (usize i = 0; i < colliders; ++i) {
+            const auto entity = world.create_entity();
+            world.add_component<Transform>(entity).value.setPosition(
+                glm::vec3(randf(-0.5f, 0.5f) * space.width, 0.0f,
+                    randf(-0.5f, 0.5f) * space.height));
+            world.add_component<Collider>(entity, randf(0.25f, 1.25f));
+        }
+
+        usize all_pairs = 0, grid_pairs = 0;
+        const auto pairs_per_iteration = colliders * colliders / 2;
+        const auto all_pairs_iterations = std::clamp<usize>(
+            options.iterations * 500'000 / pairs_per_iteration, 1, options.iterations);
+        const auto test_all_pairs = [&] {
+            all_pairs = 0;
+            world.for_each_entity_pair<Transform, Collider>([&](ecs::Entity a, ecs::Entity b) {
+                const auto rel = world.get_component<const Transform>(b).value.getPosition()
+                    - world.get_component<const Transform>(a).value.getPosition();
+                const auto radius = world.get_component<const Collider>(a).radius
+                    + world.get_component<const Collider>(b).radius;
+                if (glm::dot(rel, rel) < radius * radius) {
+                    all_pairs++;
+                }
+            });
+        };
+        const auto all_pairs_ns
+            = measure(all_pairs_iterations, test_all_pairs, all_pairs_iterations > 1);
+        const auto grid_ns = measure(options.iterations, [&] {
+            grid_pairs = 0;
+            world.for_each_entity_pair<Transform, Collider>(
+                space,
+                [](ecs::Entity, const Transform& transform, const Collider& collider) {
+                    const auto pos = transform.value.getPosition();
+                    return ecs::Circle { pos.x, pos.z, collider.radius };
+                },
+                [&](ecs::Entity, ecs::Entity) { grid_pairs++; });
+        });
+        if (grid_pairs != all_pairs) {
+            fmt::println(stderr, "Broadphase found {} pairs instead of {}", grid_pairs, all_pairs);
+        }
+        results.push_back(Broadphase { colliders, grid_pairs, all_pairs_ns, grid_ns });
+    }
+    return results;
+}
+
+std::vector<std::string> physics_scaling(const Options& options, float dt)
+{
+    std::vector<std::string> results;
+    u64 single_thread_ns = 0;
+    for (usize threads = 1;; threads = std::min(threads * 2, options.threads)) {
+        ThreadPool pool(threads);
+        const auto ns = measure(options.iterations, [&pool, dt] { physics_parallel(pool, dt); });
+        if (threads == 1) {
+            single_thread_ns = ns;
+        }
+        results.push_back(fmt::format("{{\"threads\": {}, \"ns\": {}, \"speedup\": {:.2f}}}",
+            threads, ns,
+            static_cast<double>(single_thread_ns) / static_cast<double>(std::max<u64>(ns, 1))));
+        if (threads >= options.threads) {
+            break;
+        }
+    }
+    return results;
+}
+
+std::string result(std::string_view name, usize entities, const Comparison& comparison)
+{
+    return fmt::format("\"{}\": {{\"entities\": {}, \"get_ns\": {}, \"typed_ns\": {}, "
+                       "\"speedup\": {:.2f}}}",
+        name, entities, comparison.get_ns, comparison.typed_ns,
+        static_cast<double>(comparison.get_ns)
+            / static_cast<double>(std::max<u64>(comparison.typed_ns, 1)));
+}
+
+template <typename T>
+bool parse(std::string_view str, T& value)
+{
+    const auto res = std::from_chars(str.data(), str.data() + str.size(), value);
+    return res.ec == std::errc() && res.ptr == str.data() + str.size();
+}
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const std::string_view value = i + 1 < argc ? argv[i + 1] : "";
+        bool ok = false;
+        if (arg == "--entities") {
+            ok = parse(value, options.entities);
+        } else if (arg == "--asteroids") {
+            ok = parse(value, options.asteroids);
+        } else if (arg == "--bullets") {
+            ok = parse(value, options.bullets);
+        } else if (arg == "--iterations") {
+            ok = parse(value, options.iterations) && options.iterations > 0;
+        } else if (arg == "--threads") {
+            ok = parse(value, options.threads) && options.threads > 0;
+        } else if (arg == "--churn-ops") {
+            ok = parse(value, options.churn_ops);
+        } else if (arg == "--burst") {
+            ok = parse(value, options.burst);
+        } else if (arg == "--max-colliders") {
+            ok = parse(value, options.max_colliders);
+        }
+        if (!ok) {
+            fmt::println(stderr, "Invalid argument '{}'", arg);
+            fmt::println(stderr,
+                "Usage: gac-bench-ecs [--entities N] [--asteroids N] [--bullets N] "
+                "[--iterations N] [--threads N] [--churn-ops N] [--burst N] "
+                "[--max-colliders N]");
+            return 1;
+        }
+        i++;
+    }
+    options.asteroids = std::min(options.asteroids, options.entities);
+    options.bullets = std::min(options.bullets, options.entities - options.asteroids);
+
+    seed_rng(Rng::default_seed);
+    const auto entities = create_entities(options);
+
+    constexpr auto dt = 1.0f / 60.0f;
+    std::vector<std::string> results;
+    results.push_back(result("physics", options.entities,
+        compare(options.iterations, [] { physics_get(dt); }, [] { physics_typed(dt); })));
+    results.push_back(result("collide_asteroids", options.asteroids,
+        compare(options.iterations, collide_asteroids_get, collide_asteroids_typed)));
+    results.push_back(result("shoot_asteroids", options.bullets,
+        compare(options.iterations, shoot_asteroids_get, shoot_asteroids_typed)));
+    const auto scaling = physics_scaling(options, dt);
+    const auto changes = change_detection(entities, options.iterations);
+    const auto snapshot = snapshots(options.iterations);
+    const auto spawned = spawn(options.burst, options.iterations);
+    const auto broadphases = broadphase(options);
+    const auto churn_ns = entity_churn(options.churn_ops);
+
+    fmt::println("{{");
+    fmt::println("  \"storage\": \"{}\",", storage_name);
+    fmt::println("  \"results\": {{");
+    for (usize i = 0; i < results.size(); ++i) {
+        fmt::println("    {}{}", results[i], i + 1 < results.size() ? "," : "");
+    }
+    fmt::println("  }},");
+    fmt::println("  \"physics_scaling\": {{");
+    fmt::println("    \"entities\": {},", options.entities);
+    fmt::println("    \"threads\": [");
+    for (usize i = 0; i < scaling.size(); ++i) {
+        fmt::println("      {}{}", scaling[i], i + 1 < scaling.size() ? "," : "");
+    }
+    fmt::println("    ]");
+    fmt::println("  }},");
+    fmt::println("  \"change_detection\": {{\"entities\": {}, \"all_ns\": {}, "
+                 "\"none_changed_ns\": {}, \"some_changed_ns\": {}}},",
+        options.entities, changes.all_ns, changes.none_changed_ns, changes.some_changed_ns);
+    fmt::println("  \"snapshot\": {{\"entities\": {}, \"bytes\": {}, \"snapshot_ns\": {}, "
+                 "\"restore_ns\": {}, \"compressed_bytes\": {}, \"compressed_snapshot_ns\": {}, "
+                 "\"compressed_restore_ns\": {}}},",
+        options.entities, snapshot.bytes, snapshot.snapshot_ns, snapshot.restore_ns,
+        snapshot.compressed_bytes, snapshot.compressed_snapshot_ns, snapshot.compressed_restore_ns);
+    fmt::println("  \"spawn\": {{\"entities\": {}, \"add_ns\": {}, \"instantiate_ns\": {}, "
+                 "\"speedup\": {:.2f}}},",
+        options.burst, spawned.add_ns, spawned.instantiate_ns,
+        static_cast<double>(spawned.add_ns)
+            / static_cast<double>(std::max<u64>(spawned.instantiate_ns, 1)));
+    fmt::println("  \"broadphase\": [");
+    for (usize i = 0; i < broadphases.size(); ++i) {
+        const auto& b = broadphases[i];
+        fmt::println("    {{\"colliders\": {}, \"pairs\": {}, \"all_pairs_ns\": {}, "
+                     "\"grid_ns\": {}, \"speedup\": {:.2f}}}{}",
+            b.colliders, b.pairs, b.all_pairs_ns, b.grid_ns,
+            static_cast<double>(b.all_pairs_ns) / static_cast<double>(std::max<u64>(b.grid_ns, 1)),
+            i + 1 < broadphases.size() ? "," : "");
+    }
+    fmt::println("  ],");
+    fmt::println("  \"entity_churn\": {{\"ops\": {}, \"ns_per_op\": {:.1f}}}", options.churn_ops,
+        churn_ns);
+    fmt::println("}}");
+
+    for (const auto entity : entities) {
+        ecs::destroy(entity);
+    }
+    return 0;
+}
@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <charconv>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "shared.hpp"
+
+namespace classic_ecs {
+const Game& get_game();
+}
+namespace classic_ecs_archetype {
+const Game& get_game();
+}
+namespace base_entity {
+const Game& get_game();
+}
+namespace unity_style {
+const Game& get_game();
+}
+namespace uber_entity {
+const Game& get_game();
+}
+namespace no_polymorphism {
+const Game& get_game();
+}
+namespace hybrid {
+const Game& get_game();
+}
+namespace hybrid_archetype {
+const Game& get_game();
+}
+namespace hybrid_lua {
+const Game& get_game();
+}
+
+namespace {
+struct Scenario {
+    usize num_asteroids = 100;
+    double bullets_per_second = 10.0;
+    usize frames = 1000;
+    double dt = 1.0 / 60.0;
+    u64 seed = Rng::default_seed;
+    // If not empty, a Chrome trace is written to <trace_prefix><variant>.json
+    std::string trace_prefix;
+    // Replaces the scripted input, dt, number of frames, asteroids and seed
+    std::optional<InputRecording> replay;
+};
+
+// The ship turns constantly (to spray bullets everywhere) and presses shoot bullets_per_second
+// times per second. Shoot has to be released for at least a frame in between, so this can shoot at
+// most every other frame.
+PlayerInput get_scripted_input(const Scenario& scenario, usize frame)
+{
+    if (scenario.replay) {
+        return scenario.replay->frames[frame].input;
+    }
+    const auto shots = [&scenario](usize f) {
+        return static_cast<u64>(static_cast<double>(f) * scenario.dt * scenario.bullets_per_second);
+    };
+    return PlayerInput {
+        .accel = false,
+        .turn_left = true,
+        .turn_right = false,
+        .shoot = shots(frame) != shots(frame + 1),
+    };
+}
+
+usize get_peak_rss_kib()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes
+#else
+    return usage.ru_maxrss; // kilobytes
+#endif
+}
+
+u64 percentile(std::vector<u64> values, double p)
+{
+    std::sort(values.begin(), values.end());
+    const auto idx = static_cast<usize>(p * static_cast<double>(values.size() - 1));
+    return values[idx];
+}
+
+std::string run_scenario(const Game& game, const Scenario& scenario)
+{
+    prof::set_thread_name("main");
+    set_render_backend(RenderBackend::Null);
+    init("gac-bench");
+
+    seed_rng(scenario.seed);
+    game.init(GameConfig { .num_asteroids = scenario.num_asteroids });
+    reset_system_stats();
+
+    std::vector<u64> frame_times;
+    frame_times.reserve(scenario.frames);
+    u64 update_ns = 0;
+    u64 render_ns = 0;
+    // Scripted scenarios simulate exactly one step per frame, replays step like they were recorded
+    FixedTimestep timestep(
+        scenario.replay ? scenario.replay->timestep : TimestepConfig { .rate_hz = 0.0f });
+    for (usize frame = 0; frame < scenario.frames; ++frame) {
+        PROFILE_ZONE("frame");
+        set_player_input(get_scripted_input(scenario, frame));
+        const auto dt = scenario.replay ? scenario.replay->frames[frame].dt
+                                        : static_cast<float>(scenario.dt);
+
+        const auto start = get_time_ns();
+        const auto steps = timestep.advance(dt);
+        for (u32 i = 0; i < steps; ++i) {
+            game.update(timestep.step_dt(dt));
+        }
+        const auto updated = get_time_ns();
+        begin_frame();
+        game.render(timestep.alpha());
+        end_frame();
+        const auto end = get_time_ns();
+
+        update_ns += updated - start;
+        render_ns += end - updated;
+        frame_times.push_back(end - start);
+    }
+
+    u64 total_ns = 0;
+    for (const auto t : frame_times) {
+        total_ns += t;
+    }
+    const auto frames = static_cast<double>(scenario.frames);
+
+    std::string systems;
+    for (const auto& sys : get_system_stats()) {
+        systems += fmt::format("{}\"{}\": {{\"ns_per_frame\": {:.1f}, \"calls\": {}}}",
+            systems.empty() ? "" : ", ", sys.name, static_cast<double>(sys.total_ns) / frames,
+            sys.calls);
+    }
+
+    game.shutdown();
+
+    if (!scenario.trace_prefix.empty()) {
+        const auto path = scenario.trace_prefix + game.name + ".json";
+        if (!prof::write_chrome_trace(path.c_str())) {
+            fmt::println(stderr, "Could not write trace to '{}'", path);
+        }
+    }
+
+    return fmt::format("{{\"name\": \"{}\", \"ns_per_frame\": {{\"mean\": {:.1f}, \"median\": {}, "
+                       "\"p99\": {}, \"max\": {}}}, \"update_ns_per_frame\": {:.1f}, "
+                       "\"render_ns_per_frame\": {:.1f}, \"systems\": {{{}}}, \"draw_calls\": {}, "
+                       "\"peak_rss_kib\": {}}}",
+        game.name, static_cast<double>(total_ns) / frames, percentile(frame_times, 0.5),
+        percentile(frame_times, 0.99), percentile(frame_times, 1.0),
+        static_cast<double>(update_ns) / frames, static_cast<double>(render_ns) / frames, systems,
+        get_render_stats().draw_calls, get_peak_rss_kib());
+}
+
+// Every variant runs in its own process, so they can't influence each other (global state, heap
+// fragmentation) and the peak RSS is per variant.
+std::string run_scenario_in_child(const Game& game, const Scenario& scenario)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        fmt::println(stderr, "Could not create pipe");
+        std::exit(1);
+    }
+
+    const auto pid = fork();
+    if (pid < 0) {
+        fmt::println(stderr, "Could not fork");
+        std::exit(1);
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        const auto result = run_scenario(game, scenario);
+        usize written = 0;
+        while (written < result.size()) {
+            const auto n = write(fds[1], result.data() + written, result.size() - written);
+            if (n <= 0) {
+                _exit(1);
+            }
+            written += n;
+        }
+        close(fds[1]);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    std::string result;
+    char buf[4096];
+    ssize_t n = 0;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+        result.append(buf, n);
+    }
+    close(fds[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || result.empty()) {
+        return fmt::format("{{\"name\": \"{}\", \"error\": \"child exited abnormally ({})\"}}",
+            game.name, status);
+    }
+    return result;
+}
+
+template <typename T>
+bool parse(std::string_view str, T& value)
+{
+    const auto res = std::from_chars(str.data(), str.data() + str.size(), value);
+    return res.ec == std::errc() && res.ptr == str.data() + str.size();
+}
+
+void print_usage()
+{
+    fmt::println(stderr,
+        "Usage: gac-bench [--asteroids N] [--bullets-per-second N] [--frames N] [--dt SECONDS] "
+        "[--seed N] [--replay FILE] [--trace PREFIX] [VARIANT...]");
+}
+}
+
+int main(int argc, char** argv)
+{
+    const std::vector<const Game*> games {
+        &classic_ecs::get_game(),
+        &classic_ecs_archetype::get_game(),
+        &base_entity::get_game(),
+        &unity_style::get_game(),
+        &uber_entity::get_game(),
+        &no_polymorphism::get_game(),
+        &hybrid::get_game(),
+        &hybrid_archetype::get_game(),
+        &hybrid_lua::get_game(),
+    };
+
+    Scenario scenario;
+    std::vector<const Game*> selected;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const std::string_view value = i + 1 < argc ? argv[i + 1] : "";
+        bool ok = true;
+        if (arg == "--asteroids") {
+            ok = parse(value, scenario.num_asteroids);
+            i++;
+        } else if (arg == "--bullets-per-second") {
+            ok = parse(value, scenario.bullets_per_second);
+            i++;
+        } else if (arg == "--frames") {
+            ok = parse(value, scenario.frames) && scenario.frames > 0;
+            i++;
+        } else if (arg == "--dt") {
+            ok = parse(value, scenario.dt) && scenario.dt > 0.0;
+            i++;
+        } else if (arg == "--seed") {
+            ok = parse(value, scenario.seed);
+            i++;
+        } else if (arg == "--replay") {
+            scenario.replay = load_input_recording(value);
+            ok = scenario.replay && !scenario.replay->frames.empty();
+            if (ok) {
+                scenario.num_asteroids = scenario.replay->num_asteroids;
+                scenario.seed = scenario.replay->seed;
+                scenario.frames = scenario.replay->frames.size();
+            }
+            i++;
+        } else if (arg == "--trace") {
+            scenario.trace_prefix = value;
+            i++;
+        } else {
+            const auto it = std::find_if(games.begin(), games.end(),
+                [arg](const Game* game) { return game->name == arg; });
+            ok = it != games.end();
+            if (ok) {
+                selected.push_back(*it);
+            }
+        }
+
+        if (!ok) {
+            fmt::println(stderr, "Invalid argument '{}'", arg);
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (selected.empty()) {
+        selected = games;
+    }
+
+    const auto max_bullets_per_second = 0.5 / scenario.dt;
+    if (!scenario.replay && scenario.bullets_per_second > max_bullets_per_second) {
+        fmt::println(stderr, "Can only shoot {} bullets per second with dt = {}",
+            max_bullets_per_second, scenario.dt);
+        return 1;
+    }
+
+    fmt::println("{{");
+    fmt::println("  \"scenario\": {{\"asteroids\": {}, \"bullets_per_second\": {}, \"frames\": {}, "
+                 "\"dt\": {}, \"seed\": {}, \"replay\": {}}},",
+        scenario.num_asteroids, scenario.bullets_per_second, scenario.frames, scenario.dt,
+        scenario.seed, scenario.replay.has_value());
+    fmt::println("  \"results\": [");
+    for (usize i = 0; i < selected.size(); ++i) {
+        const auto result = run_scenario_in_child(*selected[i], scenario);
+        fmt::println("    {}{}", result, i + 1 < selected.size() ? "," : "");
+    }
+    fmt::println("  ]");
+    fmt::println("}}");
+
+    return 0;
+}
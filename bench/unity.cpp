@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <charconv>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <glwx/transform.hpp>
+
+#include "../unity-style/ecs.hpp"
+#include "shared.hpp"
+
+// Micro benchmark for the game objects in unity-style/ecs.hpp: update<C> for every component type
+// over many game objects, after they were churned a bit like in the game (asteroids split, bullets
+// expire), so the components are not just allocated in order. Prints the results as JSON. The
+// components are copies of the ones in unity-style/game.cpp.
+
+namespace {
+struct Transform;
+struct Velocity;
+struct Mesh;
+struct Lifetime;
+struct Collider;
+struct Asteroid;
+struct Bullet;
+
+using Components = ComponentList<Transform, Velocity, Mesh, Lifetime, Collider, Asteroid, Bullet>;
+}
+
+COMPONENT_LIST(Components);
+
+namespace {
+struct Transform : public Component {
+    glwx::Transform transform;
+    TransformHistory history;
+
+    void update(float) override { history.save(transform); }
+};
+
+struct Velocity : public Component {
+    glm::vec3 velocity = glm::vec3(0.0f);
+
+    Velocity(const glm::vec3& vel) : velocity(vel) { }
+
+    void update(float dt) override
+    {
+        auto& trafo = get_component<Transform>().transform;
+        auto pos = trafo.getPosition() + velocity * dt;
+        if (pos.x < -view_bounds_size.x * 0.5f) {
+            pos.x += view_bounds_size.x;
+        }
+        if (pos.x > view_bounds_size.x * 0.5f) {
+            pos.x -= view_bounds_size.x;
+        }
+        if (pos.z < -view_bounds_size.y * 0.5f) {
+            pos.z += view_bounds_size.y;
+        }
+        if (pos.z > view_bounds_size.y * 0.5f) {
+            pos.z -= view_bounds_size.y;
+        }
+        trafo.setPosition(pos);
+    }
+};
+
+struct Mesh : public Component {
+    MeshHandle mesh;
+    TextureHandle texture;
+};
+
+// Bullets never expire here, so the number of game objects stays the same
+struct Lifetime : public Component {
+    float time = 1.0f;
+
+    void update(float dt) override { time -= dt; }
+};
+
+struct Collider : public Component {
+    float radius;
+
+    Collider(float r) : radius(r) { }
+};
+
+struct Asteroid : public Component { };
+
+struct Bullet : public Component { };
+
+struct Options {
+    usize objects = 100'000;
+    usize iterations = 50;
+    // Every round replaces a tenth of the game objects
+    usize churn_rounds = 10;
+};
+
+GameObjectId create_object(usize i)
+{
+    auto obj = create_game_object();
+    obj->add_component<Transform>().transform.setPosition(glm::vec3(
+        randf(-0.5f, 0.5f) * view_bounds_size.x, 0.0f, randf(-0.5f, 0.5f) * view_bounds_size.y));
+    const auto angle = randf(0.0f, glm::pi<float>() * 2.0f);
+    obj->add_component<Velocity>(glm::vec3(glm::cos(angle), 0.0f, glm::sin(angle)));
+    obj->add_component<Mesh>();
+    // Like in the game, most of them are asteroids
+    if (i % 10 == 0) {
+        obj->add_component<Lifetime>();
+        obj->add_component<Bullet>();
+        obj->add_component<Collider>(1.0f);
+    } else {
+        obj->add_component<Collider>(randf(0.5f, 2.5f));
+        obj->add_component<Asteroid>();
+    }
+    return obj->id;
+}
+
+void create_objects(const Options& options)
+{
+    std::vector<GameObjectId> ids;
+    for (usize i = 0; i < options.objects; ++i) {
+        ids.push_back(create_object(i));
+    }
+    for (usize round = 0; round < options.churn_rounds; ++round) {
+        for (usize i = 0; i < ids.size() / 10; ++i) {
+            const auto idx = static_cast<usize>(randf(0.0f, 1.0f) * static_cast<float>(ids.size()));
+            auto& id = ids[std::min(idx, ids.size() - 1)];
+            if (auto obj = get_game_object(id); obj && !obj->marked_for_destruction()) {
+                obj->destroy();
+            }
+        }
+        destroy_marked_for_destruction();
+        for (usize i = 0; i < ids.size(); ++i) {
+            if (!get_game_object(ids[i])) {
+                ids[i] = create_object(i);
+            }
+        }
+    }
+}
+
+// Median nanoseconds per call
+template <typename Func>
+u64 measure(usize iterations, Func func)
+{
+    func(); // warm up
+    std::vector<u64> times;
+    for (usize i = 0; i < iterations; ++i) {
+        const auto start = get_time_ns();
+        func();
+        times.push_back(get_time_ns() - start);
+    }
+    std::sort(times.begin(), times.end());
+    return times[iterations / 2];
+}
+
+template <typename T>
+bool parse(std::string_view str, T& value)
+{
+    const auto res = std::from_chars(str.data(), str.data() + str.size(), value);
+    return res.ec == std::errc() && res.ptr == str.data() + str.size();
+}
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const std::string_view value = i + 1 < argc ? argv[i + 1] : "";
+        bool ok = false;
+        if (arg == "--objects") {
+            ok = parse(value, options.objects);
+        } else if (arg == "--iterations") {
+            ok = parse(value, options.iterations) && options.iterations > 0;
+        } else if (arg == "--churn-rounds") {
+            ok = parse(value, options.churn_rounds);
+        }
+        if (!ok) {
+            fmt::println(stderr, "Invalid argument '{}'", arg);
+            fmt::println(
+                stderr, "Usage: gac-bench-unity [--objects N] [--iterations N] [--churn-rounds N]");
+            return 1;
+        }
+        i++;
+    }
+
+    seed_rng(Rng::default_seed);
+    create_objects(options);
+
+    constexpr auto dt = 1.0f / 60.0f;
+    const auto transform_ns = measure(options.iterations, [] { update<Transform>(dt); });
+    const auto velocity_ns = measure(options.iterations, [] { update<Velocity>(dt); });
+    const auto lifetime_ns = measure(options.iterations, [] { update<Lifetime>(dt); });
+
+    fmt::println("{{");
+    fmt::println("  \"objects\": {},", options.objects);
+    fmt::println("  \"churn_rounds\": {},", options.churn_rounds);
+    fmt::println("  \"update_ns\": {{\"Transform\": {}, \"Velocity\": {}, \"Lifetime\": {}}}",
+        transform_ns, velocity_ns, lifetime_ns);
+    fmt::println("}}");
+
+    for_each_game_object([](GameObjectId, GameObject& obj) { obj.destroy(); });
+    return 0;
+}
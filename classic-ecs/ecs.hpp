@@ -1,13 +1,34 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
 #include <cstring>
-#include <queue>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include <cppasta/generational_index.hpp>
 #include <cppasta/primitive_typedefs.hpp>
 
+#include "lz.hpp"
+#include "thread_pool.hpp"
+
 namespace ecs {
 
 /*
@@ -21,228 +42,3135 @@ it is the easiest and simplest ECS I could come up with and I think it's super s
 The only thing that I might still consider doing is getting rid of the component_id stuff and just
 requiring you define your own id. Then I could get rid of two functions (it's the ones that are the
 least obvious as well), but I am afraid it might be a bit error-prone.
+
+The paragraphs above describe the first version of this file. It has grown a lot since then and
+now contains:
+* Up to ECS_MAX_COMPONENTS component types. Their ids can be registered at compile time (a list of
+  all components of a game with ECS_COMPONENT_LIST or single ones with ECS_COMPONENT_ID), the rest
+  are assigned at runtime.
+* Two storage backends with the same interface, so they can be compared:
+  * PoolWorld (the default) stores every component type in a pool indexed by entity index (or in a
+    sparse set, see ComponentStorage).
+  * ArchetypeWorld (if ECS_ARCHETYPE_STORAGE is defined) groups entities with the same component
+    mask into an archetype, which stores their components in chunks of ChunkRows entities, one
+    array per component type. Queries only look at the archetypes that match and everything they
+    touch is contiguous, but adding or removing a component moves the entity to another archetype,
+    so references to components are only valid until the components of any entity change.
+* Change detection for queries (Changed and Added filters).
+* Command buffers, which record structural changes and apply them later.
+* Prefabs, which entities can be instantiated from.
+* Snapshots of a world, optionally LZ compressed.
+* Parallel iteration on the thread pool (parallel_for_each).
+* A grid broadphase for the pairs of entities whose circles overlap (for_each_pair).
 */
 
 struct EntityTag { };
 using Entity = pasta::CompositeId<EntityTag>;
 
-using ComponentMask = u64;
+#ifndef ECS_MAX_COMPONENTS
+#define ECS_MAX_COMPONENTS 256
+#endif
 
-constexpr usize MaxComponents = 64;
-constexpr usize MaxEntities = 1024;
+constexpr usize MaxComponents = ECS_MAX_COMPONENTS;
+static_assert(MaxComponents % 64 == 0);
 
-namespace detail {
-    static usize& get_component_id_counter()
+// A bit for every component. Checking whether a mask contains another one is done for every query
+// on every structural change, so it is vectorized (with AVX2, 256 bits at a time) if possible.
+class ComponentMask {
+public:
+    static constexpr usize NumWords = MaxComponents / 64;
+
+    struct Hash {
+        usize operator()(const ComponentMask& mask) const
+        {
+            u64 hash = 0;
+            for (const auto word : mask.words_) {
+                hash = (hash ^ word) * 0x100000001b3; // FNV-1a per word
+            }
+            return static_cast<usize>(hash);
+        }
+    };
+
+    constexpr ComponentMask() = default;
+
+    constexpr bool test(usize id) const { return words_[id / 64] & (u64(1) << (id % 64)); }
+    constexpr void set(usize id) { words_[id / 64] |= u64(1) << (id % 64); }
+    constexpr void reset(usize id) { words_[id / 64] &= ~(u64(1) << (id % 64)); }
+    constexpr void flip(usize id) { words_[id / 64] ^= u64(1) << (id % 64); }
+
+    constexpr ComponentMask flipped(usize id) const
     {
-        static usize component_id_counter = 0;
-        return component_id_counter;
+        auto mask = *this;
+        mask.flip(id);
+        return mask;
     }
 
-    template <typename T>
-    usize component_id()
+    constexpr ComponentMask operator|(const ComponentMask& other) const
     {
-        static auto id = get_component_id_counter()++;
-        assert(id < MaxComponents);
-        return id;
+        auto mask = *this;
+        for (usize i = 0; i < NumWords; ++i) {
+            mask.words_[i] |= other.words_[i];
+        }
+        return mask;
     }
 
-    template <typename... Ts>
-    ComponentMask component_mask()
+    constexpr bool operator==(const ComponentMask& other) const = default;
+
+    // Whether every component in other is in this mask too
+    constexpr bool contains(const ComponentMask& other) const
     {
-        return ((1 << component_id<Ts>()) | ...);
+#ifdef __AVX2__
+        if constexpr (NumWords % 4 == 0) {
+            if (!std::is_constant_evaluated()) {
+                for (usize i = 0; i < NumWords; i += 4) {
+                    const auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&words_[i]));
+                    const auto b
+                        = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&other.words_[i]));
+                    // testc is 1 if ~a & b is 0
+                    if (!_mm256_testc_si256(a, b)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        }
+#endif
+        u64 missing = 0;
+        for (usize i = 0; i < NumWords; ++i) {
+            missing |= other.words_[i] & ~words_[i];
+        }
+        return missing == 0;
     }
 
-    // These should be owned by World, but we only have one instance of ECS and we want this to be
-    // simple
-    template <typename T>
-    T& component(usize idx)
+    constexpr bool intersects(const ComponentMask& other) const
     {
-        static std::array<T, MaxEntities> pool;
-        assert(idx < pool.size());
-        return pool[idx];
+        u64 common = 0;
+        for (usize i = 0; i < NumWords; ++i) {
+            common |= words_[i] & other.words_[i];
+        }
+        return common != 0;
     }
-}
 
-class World {
-public:
-    static World& instance()
+    // Calls func(id) for every component in the mask, in order
+    template <typename Func>
+    void for_each(Func func) const
     {
-        static World world;
-        return world;
+        for (usize i = 0; i < NumWords; ++i) {
+            for (auto word = words_[i]; word; word &= word - 1) {
+                func(i * 64 + std::countr_zero(word));
+            }
+        }
     }
 
-    World()
+private:
+    std::array<u64, NumWords> words_ {};
+};
+
+// Components can be registered with a fixed id (ECS_COMPONENT_ID or ECS_COMPONENT_LIST), which
+// makes their ids and the masks of queries that only use registered components constant
+// expressions, so getting a component doesn't have to check whether its id was assigned yet. All
+// other components get an id when they are used for the first time, counting down from
+// MaxComponents - 1, so they don't collide with the registered ones, which should count up from 0.
+template <typename T>
+struct ComponentId {
+    static constexpr bool registered = false;
+};
+
+// Has to be used in the global namespace
+#define ECS_COMPONENT_ID(Type, Id)                                                                 \
+    template <>                                                                                    \
+    struct ecs::ComponentId<Type> {                                                                \
+        static_assert((Id) < ::ecs::MaxComponents);                                                \
+        static constexpr bool registered = true;                                                   \
+        static constexpr ::usize value = (Id);                                                     \
+    }
+
+// The components of a game (or a world), which get the ids 0, 1, 2, ... in the order of the list
+// with ECS_COMPONENT_LIST:
+//     using Components = ecs::ComponentList<Transform, Velocity, Mesh>;
+//     ECS_COMPONENT_LIST(Components);
+// Unlike runtime ids, they don't depend on which component is used first, so they are the same in
+// every run and build (as long as the list is) and snapshots can be restored by another process.
+// component_id is inline, so types that are used by more than one game in a program (e.g.
+// glwx::Transform) need the same id in all of them.
+template <typename... Ts>
+struct ComponentList {
+    static constexpr usize size = sizeof...(Ts);
+
+    template <typename T>
+    static constexpr usize count = (static_cast<usize>(std::is_same_v<T, Ts>) + ... + 0);
+
+    template <typename T>
+    static constexpr bool contains = count<T> > 0;
+
+    template <typename T>
+        requires contains<T>
+    static constexpr usize index = [] {
+        usize idx = 0;
+        ((std::is_same_v<T, Ts> ? false : (idx++, true)) && ...);
+        return idx;
+    }();
+
+    static_assert(size <= MaxComponents);
+    static_assert(((count<Ts> == 1) && ...), "Every component can only be in the list once");
+};
+
+// Has to be used in the global namespace, before the components of the list are used
+#define ECS_COMPONENT_LIST(List)                                                                   \
+    template <typename T>                                                                          \
+        requires(List::template contains<T>)                                                       \
+    struct ecs::ComponentId<T> {                                                                   \
+        static constexpr bool registered = true;                                                   \
+        static constexpr ::usize value = List::template index<T>;                                  \
+    }
+
+// How PoolWorld stores a component type (ArchetypeWorld stores every component in its archetypes).
+// Dense pools have a slot for every entity index in the pages they use, so a component is found
+// with a single lookup and references to it stay valid. Sparse sets pack the components that exist
+// into one array and only keep an index into it for every entity index, which is less memory for
+// components that few entities have, but adding one of them may move all of them.
+enum class Storage { Dense, Sparse };
+
+template <typename T>
+struct ComponentStorage {
+    static constexpr Storage value = Storage::Dense;
+};
+
+// Has to be used in the global namespace
+#define ECS_COMPONENT_STORAGE(Type, Policy)                                                        \
+    template <>                                                                                    \
+    struct ecs::ComponentStorage<Type> {                                                           \
+        static constexpr ::ecs::Storage value = ::ecs::Storage::Policy;                            \
+    }
+
+// What World::memory_usage reports for every component type that was used
+struct ComponentMemory {
+    usize id = 0;
+    usize count = 0; // Entities that have the component
+    usize bytes = 0; // Everything allocated to store the components
+};
+
+// Every world has a tick, which advances every time a query with a Changed or Added filter starts.
+// Components remember the tick they were added and last changed at. At a few dozen filtered
+// queries per frame, it takes weeks for the tick to wrap around.
+using Tick = u32;
+
+struct ComponentTicks {
+    Tick added = 0;
+    Tick changed = 0;
+};
+
+// Query filters, which make for_each only visit the entities whose component T was changed (or
+// added) since last_run and then set last_run to the tick the query started at:
+//     static ecs::Tick last_run = 0;
+//     ecs::for_each<const Transform, const Mesh>(ecs::Changed<Transform>(last_run), func);
+// Every query needs its own last_run. Changes made while it runs (by func too) are seen by the
+// next run.
+// A component counts as changed when it is added, returned by get or try_get as non-const,
+// passed to a typed for_each as non-const or marked with mark_changed.
+template <typename T>
+struct Changed {
+    using Component = T;
+
+    explicit Changed(Tick& last_run)
+        : last_run(last_run)
     {
-        for (usize i = 0; i < entities_.size(); ++i) {
-            entities_[i].id = Entity(i, 1);
-        }
     }
 
-    Entity create_entity()
+    static bool matches(const ComponentTicks& ticks, Tick last_run)
     {
-        const auto idx = get_free_entity_idx();
-        assert(idx < entities_.size());
-        return entities_[idx].id;
+        return ticks.changed > last_run;
     }
 
-    bool exists(Entity entity) const
+    Tick& last_run;
+};
+
+template <typename T>
+struct Added {
+    using Component = T;
+
+    explicit Added(Tick& last_run)
+        : last_run(last_run)
     {
-        assert(entity.idx() < entities_.size());
-        return entities_[entity.idx()].id.gen() == entity.gen();
     }
 
-    void destroy_entity(Entity entity)
+    static bool matches(const ComponentTicks& ticks, Tick last_run)
     {
-        assert(exists(entity));
-        entities_[entity.idx()].id = entities_[entity.idx()].id.next_generation();
-        entities_[entity.idx()].cmask = 0;
-        free_list_.push(entity.idx());
+        return ticks.added > last_run;
     }
 
-    template <typename T, typename... Args>
-    T& add_component(Entity entity, Args&&... args)
+    Tick& last_run;
+};
+
+namespace detail {
+    // Atomic, because command buffers might use a component type for the first time on any thread
+    inline std::atomic<usize>& get_component_id_counter()
     {
-        static_assert(std::is_standard_layout_v<T>);
-        assert(!has_component<T>(entity));
-        entities_[entity.idx()].cmask |= detail::component_mask<T>();
-        auto& comp = detail::component<T>(entity.idx());
-        comp = T { std::forward<Args>(args)... };
-        return comp;
+        static std::atomic<usize> component_id_counter = 0;
+        return component_id_counter;
     }
 
     template <typename T>
-    T& get_component(Entity entity) const
+    usize dynamic_component_id()
     {
-        assert(has_component<T>(entity));
-        return detail::component<T>(entity.idx());
+        static const auto id = [] {
+            const auto count = get_component_id_counter()++;
+            assert(count < MaxComponents);
+            return MaxComponents - 1 - count;
+        }();
+        return id;
     }
 
     template <typename T>
-    T* try_get_component(Entity entity) const
+    constexpr usize component_id()
     {
-        return has_component<T>(entity) ? &detail::component<T>(entity.idx()) : nullptr;
+        if constexpr (ComponentId<T>::registered) {
+            return ComponentId<T>::value;
+        } else {
+            return dynamic_component_id<T>();
+        }
     }
 
-    template <typename T>
-    void remove_component(Entity entity)
+    // What for_each without a filter uses, which is compiled out
+    struct NoFilter {
+        using Component = void;
+    };
+
+    template <typename Filter>
+    concept QueryFilter = requires(const ComponentTicks& ticks, Tick last_run) {
+        typename Filter::Component;
+        { Filter::matches(ticks, last_run) } -> std::same_as<bool>;
+    };
+
+    template <typename... Ts>
+    std::array<usize, sizeof...(Ts)> component_ids()
     {
-        assert(has_component<T>(entity));
-        entities_[entity.idx()].cmask &= ~detail::component_mask<T>();
+        return { component_id<Ts>()... };
     }
 
-    template <typename T>
-    bool has_component(Entity entity) const
+    template <typename... Ts>
+    constexpr ComponentMask make_component_mask()
     {
-        assert(entity.idx() < entities_.size());
-        return exists(entity) && (entities_[entity.idx()].cmask & detail::component_mask<T>()) > 0;
+        ComponentMask mask;
+        (mask.set(component_id<Ts>()), ...);
+        return mask;
     }
 
-    template <typename... Components, typename Func>
-    void for_each_entity(Func func) const
+    template <typename... Ts>
+    constexpr ComponentMask constant_component_mask = make_component_mask<Ts...>();
+
+    template <typename... Ts>
+    ComponentMask component_mask()
     {
-        const auto mask = detail::component_mask<Components...>();
-        for (size_t i = 0; i < next_entity_idx_; ++i) {
-            if ((entities_[i].cmask & mask) == mask) {
-                func(entities_[i].id);
-            }
+        if constexpr ((ComponentId<Ts>::registered && ...)) {
+            return constant_component_mask<Ts...>;
+        } else {
+            return make_component_mask<Ts...>();
         }
     }
 
-    template <typename... Components, typename Func>
-    void for_each_entity_pair(Func func) const
-    {
-        const auto last = next_entity_idx_; // func might create more entities
-        const auto mask = detail::component_mask<Components...>();
-        for (size_t i = 0; i < last; ++i) {
-            if ((entities_[i].cmask & mask) == mask) {
-                for (size_t j = i + 1; j < last; ++j) {
-                    if ((entities_[j].cmask & mask) == mask) {
-                        func(entities_[i].id, entities_[j].id);
+    // The free entity indices as a bitmap, with another bitmap on top that has a bit for every word
+    // that is not 0 and another one on top of that, so taking the lowest free index is a
+    // countr_zero per level (plus a scan of the top level, which has a word per 2^18 indices).
+    // The bitmaps only grow when the index range grows, so this does not allocate otherwise.
+    class FreeList {
+    public:
+        bool empty() const { return size_ == 0; }
+
+        bool contains(usize idx) const
+        {
+            return idx / 64 < levels_[0].size() && (levels_[0][idx / 64] & (u64(1) << (idx % 64)));
+        }
+
+        void push(usize idx)
+        {
+            assert(!contains(idx));
+            for (auto& bits : levels_) {
+                if (idx / 64 >= bits.size()) {
+                    bits.resize(idx / 64 + 1);
+                }
+                const auto was_empty = bits[idx / 64] == 0;
+                bits[idx / 64] |= u64(1) << (idx % 64);
+                if (!was_empty) {
+                    break;
+                }
+                idx /= 64;
+            }
+            size_++;
+        }
+
+        void erase(usize idx)
+        {
+            assert(contains(idx));
+            for (auto& bits : levels_) {
+                bits[idx / 64] &= ~(u64(1) << (idx % 64));
+                if (bits[idx / 64] != 0) {
+                    break;
+                }
+                idx /= 64;
+            }
+            size_--;
+        }
+
+        // Removes and returns the lowest free index
+        usize pop()
+        {
+            assert(!empty());
+            const auto& top = levels_.back();
+            usize word = 0;
+            while (top[word] == 0) {
+                word++;
+            }
+            usize idx = word * 64 + std::countr_zero(top[word]);
+            for (usize level = levels_.size() - 1; level-- > 0;) {
+                idx = idx * 64 + std::countr_zero(levels_[level][idx]);
+            }
+            erase(idx);
+            return idx;
+        }
+
+        static constexpr usize None = ~usize(0);
+
+        // Removes the lowest count consecutive free indices and returns the first one (or None if
+        // there are not that many in a row). Words that are all free or all taken are skipped at
+        // once.
+        usize pop_range(usize count)
+        {
+            assert(count > 0);
+            const auto& bits = levels_[0];
+            usize first = 0;
+            usize run = 0;
+            for (usize word = 0; word < bits.size() && run < count; ++word) {
+                if (bits[word] == 0) {
+                    run = 0;
+                } else if (bits[word] == ~u64(0)) {
+                    first = run > 0 ? first : word * 64;
+                    run += 64;
+                } else {
+                    for (usize bit = 0; bit < 64 && run < count; ++bit) {
+                        if (bits[word] & (u64(1) << bit)) {
+                            first = run > 0 ? first : word * 64 + bit;
+                            run++;
+                        } else {
+                            run = 0;
+                        }
                     }
                 }
             }
+            if (run < count) {
+                return None;
+            }
+            for (usize idx = first; idx < first + count; ++idx) {
+                erase(idx);
+            }
+            return first;
         }
-    }
 
-private:
-    struct EntityData {
-        Entity id;
-        ComponentMask cmask = 0;
+    private:
+        std::array<std::vector<u64>, 3> levels_;
+        usize size_ = 0;
     };
 
-    usize get_free_entity_idx()
+    template <typename T>
+    usize count_pages(const std::vector<std::unique_ptr<T[]>>& pages)
     {
-        if (free_list_.empty()) {
-            return next_entity_idx_++;
+        return static_cast<usize>(std::count_if(
+            pages.begin(), pages.end(), [](const auto& page) { return page != nullptr; }));
+    }
+
+    template <typename T>
+    std::vector<std::unique_ptr<T[]>> copy_pages(
+        const std::vector<std::unique_ptr<T[]>>& pages, usize page_size)
+    {
+        std::vector<std::unique_ptr<T[]>> copy(pages.size());
+        for (usize page = 0; page < pages.size(); ++page) {
+            if (pages[page]) {
+                copy[page] = std::make_unique_for_overwrite<T[]>(page_size);
+                std::copy_n(pages[page].get(), page_size, copy[page].get());
+            }
         }
-        const auto idx = free_list_.top();
-        free_list_.pop();
-        return idx;
+        return copy;
     }
 
-    // With components being PODs, we don't have to worry about destroying them
-    std::array<EntityData, MaxEntities> entities_;
-    // I don't know if this is actually good, but it keeps the components close to each other and
-    // it's super easy to do
-    std::priority_queue<usize> free_list_;
-    usize next_entity_idx_ = 0;
-};
+    // PoolWorld only knows the component ids of an entity when it destroys it (to free components
+    // of sparse sets), reports memory usage, clones its pools or takes and restores snapshots
+    class PoolBase {
+    public:
+        explicit PoolBase(Storage storage)
+            : storage(storage)
+        {
+        }
 
-Entity create()
-{
-    return World::instance().create_entity();
-}
+        virtual ~PoolBase() = default;
 
-bool exists(Entity entity)
-{
-    return World::instance().exists(entity);
-}
+        virtual void remove(usize idx) = 0;
+        virtual usize memory_usage() const = 0;
+        virtual std::unique_ptr<PoolBase> clone() const = 0;
 
-void destroy(Entity entity)
-{
-    return World::instance().destroy_entity(entity);
-}
+        // Copy the components (and ticks) of the entity indices to or from packed arrays
+        virtual void save(
+            std::span<const u32> indices, std::byte* values, ComponentTicks* ticks) const
+            = 0;
+        virtual void load(
+            std::span<const u32> indices, const std::byte* values, const ComponentTicks* ticks)
+            = 0;
+        // Removes all components
+        virtual void clear() = 0;
+        // Adds copies of value for the entity indices [first, first + count)
+        virtual void fill(usize first, usize count, const std::byte* value, ComponentTicks ticks)
+            = 0;
 
-template <typename T, typename... Args>
-T& add(Entity entity, Args&&... args)
-{
-    return World::instance().add_component<T>(entity, std::forward<Args>(args)...);
-}
+        const Storage storage;
+    };
 
-template <typename T>
-T& get(Entity entity)
-{
-    return World::instance().get_component<T>(entity);
-}
+    // Components are stored in fixed size pages, which are allocated when the first component in
+    // them is added. Growing the pool never moves existing components, so references stay valid
+    // until the entity is destroyed, and component types that are never added take no memory.
+    template <typename T>
+    class ComponentPool : public PoolBase {
+    public:
+        static constexpr usize PageSize = 1024;
 
-template <typename T>
-T* try_get(Entity entity)
-{
-    return World::instance().try_get_component<T>(entity);
-}
+        ComponentPool()
+            : PoolBase(Storage::Dense)
+        {
+        }
 
-template <typename T>
-void remove(Entity entity)
-{
-    return World::instance().remove_component<T>(entity);
-}
+        T& operator[](usize idx) const
+        {
+            assert(idx / PageSize < pages_.size() && pages_[idx / PageSize]);
+            return pages_[idx / PageSize][idx % PageSize];
+        }
 
-template <typename T>
-bool has(Entity entity)
-{
-    return World::instance().has_component<T>(entity);
-}
+        void ensure(usize idx)
+        {
+            const auto page = idx / PageSize;
+            if (page >= pages_.size()) {
+                pages_.resize(page + 1);
+            }
+            if (!pages_[page]) {
+                pages_[page] = std::make_unique<T[]>(PageSize);
+                tick_pages_.resize(pages_.size());
+                tick_pages_[page] = std::make_unique<ComponentTicks[]>(PageSize);
+            }
+        }
 
-template <typename... Components, typename Func>
-void for_each(Func func)
-{
-    return World::instance().for_each_entity<Components...>(std::move(func));
-}
+        ComponentTicks& ticks(usize idx) const
+        {
+            assert(idx / PageSize < tick_pages_.size() && tick_pages_[idx / PageSize]);
+            return tick_pages_[idx / PageSize][idx % PageSize];
+        }
 
-template <typename... Components, typename Func>
-void for_each_pair(Func func)
-{
-    return World::instance().for_each_entity_pair<Components...>(std::move(func));
+        T& emplace(usize idx)
+        {
+            ensure(idx);
+            return (*this)[idx];
+        }
+
+        // The slot is kept for the next entity with this index
+        void remove(usize) override { }
+
+        usize memory_usage() const override
+        {
+            return (pages_.capacity() + tick_pages_.capacity()) * sizeof(pages_[0])
+                + count_pages(pages_) * PageSize * (sizeof(T) + sizeof(ComponentTicks));
+        }
+
+        // Components are trivially copyable, so this is a memcpy of every page
+        std::unique_ptr<PoolBase> clone() const override
+        {
+            auto pool = std::make_unique<ComponentPool>();
+            pool->pages_ = copy_pages(pages_, PageSize);
+            pool->tick_pages_ = copy_pages(tick_pages_, PageSize);
+            return pool;
+        }
+
+        // Entities with the same components usually have consecutive indices, so runs of them are
+        // copied at once
+        void save(std::span<const u32> indices, std::byte* values,
+            ComponentTicks* ticks) const override
+        {
+            for (usize i = 0, run = 0; i < indices.size(); i += run) {
+                run = run_length(indices.subspan(i));
+                std::memcpy(values + i * sizeof(T), &(*this)[indices[i]], run * sizeof(T));
+                std::memcpy(ticks + i, &this->ticks(indices[i]), run * sizeof(ComponentTicks));
+            }
+        }
+
+        void load(std::span<const u32> indices, const std::byte* values,
+            const ComponentTicks* ticks) override
+        {
+            for (usize i = 0, run = 0; i < indices.size(); i += run) {
+                run = run_length(indices.subspan(i));
+                std::memcpy(&emplace(indices[i]), values + i * sizeof(T), run * sizeof(T));
+                std::memcpy(&this->ticks(indices[i]), ticks + i, run * sizeof(ComponentTicks));
+            }
+        }
+
+        // Like remove, this keeps the pages
+        void clear() override { }
+
+        void fill(usize first, usize count, const std::byte* value, ComponentTicks ticks) override
+        {
+            const auto end = first + count;
+            for (usize idx = first, run = 0; idx < end; idx += run) {
+                run = std::min(end, (idx / PageSize + 1) * PageSize) - idx;
+                ensure(idx);
+                const auto components = &(*this)[idx];
+                for (usize i = 0; i < run; ++i) {
+                    std::memcpy(components + i, value, sizeof(T));
+                }
+                std::fill_n(&this->ticks(idx), run, ticks);
+            }
+        }
+
+    private:
+        // The number of consecutive indices at the start that are in the same page
+        static usize run_length(std::span<const u32> indices)
+        {
+            const auto page_end = (indices[0] / PageSize + 1) * PageSize;
+            usize run = 1;
+            while (run < indices.size() && indices[run] == indices[0] + run
+                && indices[run] < page_end) {
+                run++;
+            }
+            return run;
+        }
+
+        std::vector<std::unique_ptr<T[]>> pages_;
+        // Separate, so iterating over the components does not load the ticks
+        std::vector<std::unique_ptr<ComponentTicks[]>> tick_pages_;
+    };
+
+    // The components are packed into values_ and the position of an entity's component is looked
+    // up in a page of positions, so only the positions take memory for entity indices without the
+    // component (4 bytes each instead of sizeof(T)). Removing a component moves the last one into
+    // its place.
+    template <typename T>
+    class SparseSet : public PoolBase {
+    public:
+        static constexpr usize PageSize = 1024;
+        static constexpr u32 None = 0xffff'ffff;
+
+        SparseSet()
+            : PoolBase(Storage::Sparse)
+        {
+        }
+
+        T& operator[](usize idx) const
+        {
+            assert(contains(idx));
+            return values_[pages_[idx / PageSize][idx % PageSize]];
+        }
+
+        ComponentTicks& ticks(usize idx) const
+        {
+            assert(contains(idx));
+            return ticks_[pages_[idx / PageSize][idx % PageSize]];
+        }
+
+        bool contains(usize idx) const
+        {
+            return idx / PageSize < pages_.size() && pages_[idx / PageSize]
+                && pages_[idx / PageSize][idx % PageSize] != None;
+        }
+
+        T& emplace(usize idx)
+        {
+            assert(!contains(idx));
+            const auto page = idx / PageSize;
+            if (page >= pages_.size()) {
+                pages_.resize(page + 1);
+            }
+            if (!pages_[page]) {
+                pages_[page] = std::make_unique_for_overwrite<u32[]>(PageSize);
+                std::fill_n(pages_[page].get(), PageSize, None);
+            }
+            pages_[page][idx % PageSize] = static_cast<u32>(values_.size());
+            indices_.push_back(static_cast<u32>(idx));
+            ticks_.emplace_back();
+            return values_.emplace_back();
+        }
+
+        void remove(usize idx) override
+        {
+            auto& pos = pages_[idx / PageSize][idx % PageSize];
+            assert(pos != None);
+            if (pos + 1 < values_.size()) {
+                values_[pos] = values_.back();
+                ticks_[pos] = ticks_.back();
+                indices_[pos] = indices_.back();
+                pages_[indices_[pos] / PageSize][indices_[pos] % PageSize] = pos;
+            }
+            values_.pop_back();
+            ticks_.pop_back();
+            indices_.pop_back();
+            pos = None;
+        }
+
+        usize memory_usage() const override
+        {
+            return pages_.capacity() * sizeof(pages_[0])
+                + count_pages(pages_) * PageSize * sizeof(u32) + values_.capacity() * sizeof(T)
+                + ticks_.capacity() * sizeof(ComponentTicks) + indices_.capacity() * sizeof(u32);
+        }
+
+        std::unique_ptr<PoolBase> clone() const override
+        {
+            auto set = std::make_unique<SparseSet>();
+            set->pages_ = copy_pages(pages_, PageSize);
+            set->indices_ = indices_;
+            set->values_ = values_;
+            set->ticks_ = ticks_;
+            return set;
+        }
+
+        void save(std::span<const u32> indices, std::byte* values,
+            ComponentTicks* ticks) const override
+        {
+            for (usize i = 0; i < indices.size(); ++i) {
+                std::memcpy(values + i * sizeof(T), &(*this)[indices[i]], sizeof(T));
+                ticks[i] = this->ticks(indices[i]);
+            }
+        }
+
+        void load(std::span<const u32> indices, const std::byte* values,
+            const ComponentTicks* ticks) override
+        {
+            values_.reserve(values_.size() + indices.size());
+            ticks_.reserve(ticks_.size() + indices.size());
+            indices_.reserve(indices_.size() + indices.size());
+            for (usize i = 0; i < indices.size(); ++i) {
+                std::memcpy(&emplace(indices[i]), values + i * sizeof(T), sizeof(T));
+                ticks_.back() = ticks[i];
+            }
+        }
+
+        // Keeps the pages
+        void clear() override
+        {
+            for (const auto idx : indices_) {
+                pages_[idx / PageSize][idx % PageSize] = None;
+            }
+            indices_.clear();
+            values_.clear();
+            ticks_.clear();
+        }
+
+        void fill(usize first, usize count, const std::byte* value, ComponentTicks ticks) override
+        {
+            values_.reserve(values_.size() + count);
+            ticks_.reserve(ticks_.size() + count);
+            indices_.reserve(indices_.size() + count);
+            for (usize idx = first; idx < first + count; ++idx) {
+                std::memcpy(&emplace(idx), value, sizeof(T));
+                ticks_.back() = ticks;
+            }
+        }
+
+    private:
+        std::vector<std::unique_ptr<u32[]>> pages_;
+        // The entity index of every value, to fix its position when it is moved
+        std::vector<u32> indices_;
+        mutable std::vector<T> values_;
+        mutable std::vector<ComponentTicks> ticks_;
+    };
+
+    template <typename T>
+    using ComponentStorageType = std::conditional_t<ComponentStorage<T>::value == Storage::Sparse,
+        SparseSet<T>, ComponentPool<T>>;
+
+    // Both storages create and move components by component id only (archetype columns, pools of
+    // restored snapshots)
+    struct ComponentInfo {
+        usize size = 0;
+        usize align = 0;
+        void (*relocate)(void* dst, void* src) = nullptr;
+        void (*copy)(void* dst, const void* src, usize count) = nullptr;
+        std::unique_ptr<PoolBase> (*make_pool)() = nullptr;
+    };
+
+    inline std::array<ComponentInfo, MaxComponents>& component_infos()
+    {
+        static std::array<ComponentInfo, MaxComponents> infos;
+        return infos;
+    }
+
+    template <typename T>
+    usize register_component()
+    {
+        static const auto id = [] {
+            const auto id = component_id<T>();
+            component_infos()[id] = ComponentInfo {
+                sizeof(T),
+                alignof(T),
+                [](void* dst, void* src) { new (dst) T(std::move(*static_cast<T*>(src))); },
+                [](void* dst, const void* src, usize count) {
+                    const auto first = static_cast<const T*>(src);
+                    std::uninitialized_copy_n(first, count, static_cast<T*>(dst));
+                },
+                []() -> std::unique_ptr<PoolBase> {
+                    return std::make_unique<ComponentStorageType<T>>();
+                },
+            };
+            return id;
+        }();
+        return id;
+    }
+
+    // World::snapshot() writes a SnapshotHeader followed by the payload, which is compressed with
+    // lz::compress if the header has the Compressed flag:
+    // - the generation of every entity index (u32) and a bitset of the live ones (u64 words)
+    // - for every component that any entity has: a SnapshotComponent, the indices of the entities
+    //   that have it (u32), their ComponentTicks and their components, packed
+    // Every array starts at a multiple of 8 bytes and everything is in native byte order, so an
+    // uncompressed snapshot can be restored in place (e.g. from a memory-mapped file).
+    struct SnapshotHeader {
+        static constexpr u32 Magic = 0x5353'4345; // "ECSS"
+        static constexpr u32 Version = 1;
+        static constexpr u32 Compressed = 1;
+
+        u32 magic = Magic;
+        u32 version = Version;
+        u32 flags = 0;
+        Tick tick = 0;
+        u64 num_entities = 0; // Including the free indices
+        u64 num_components = 0;
+        u64 payload_size = 0;
+        u64 stored_size = 0; // Of the compressed payload if it is compressed
+    };
+
+    struct SnapshotComponent {
+        u32 id;
+        u32 size;
+        u64 count;
+    };
+
+    static_assert(std::endian::native == std::endian::little);
+    static_assert(sizeof(SnapshotHeader) % 8 == 0 && sizeof(SnapshotComponent) % 8 == 0);
+
+    constexpr usize snapshot_align(usize size)
+    {
+        return (size + 7) / 8 * 8;
+    }
+
+    // Lays out the whole snapshot up front, so the worlds can write the arrays in any order
+    class SnapshotWriter {
+    public:
+        struct Component {
+            usize id;
+            usize size;
+            usize count;
+        };
+
+        struct Arrays {
+            u32* indices;
+            ComponentTicks* ticks;
+            std::byte* values;
+        };
+
+        SnapshotWriter(Tick tick, usize num_entities, std::span<const Component> components)
+        {
+            header_.tick = tick;
+            header_.num_entities = num_entities;
+            header_.num_components = components.size();
+            usize size = sizeof(SnapshotHeader) + snapshot_align(num_entities * sizeof(u32))
+                + (num_entities + 63) / 64 * sizeof(u64);
+            for (const auto& component : components) {
+                offsets_.push_back(size);
+                size += sizeof(SnapshotComponent) + snapshot_align(component.count * sizeof(u32))
+                    + component.count * sizeof(ComponentTicks)
+                    + snapshot_align(component.count * component.size);
+            }
+            // Zeroed, so the padding is too
+            data_.resize(size);
+            for (usize i = 0; i < components.size(); ++i) {
+                const SnapshotComponent component { static_cast<u32>(components[i].id),
+                    static_cast<u32>(components[i].size), components[i].count };
+                std::memcpy(data_.data() + offsets_[i], &component, sizeof(component));
+                counts_.push_back(components[i].count);
+            }
+        }
+
+        u32* generations()
+        {
+            return reinterpret_cast<u32*>(data_.data() + sizeof(SnapshotHeader));
+        }
+
+        u64* alive()
+        {
+            return reinterpret_cast<u64*>(data_.data() + sizeof(SnapshotHeader)
+                + snapshot_align(header_.num_entities * sizeof(u32)));
+        }
+
+        // Of components[i]
+        Arrays arrays(usize i)
+        {
+            const auto indices = data_.data() + offsets_[i] + sizeof(SnapshotComponent);
+            const auto ticks = indices + snapshot_align(counts_[i] * sizeof(u32));
+            return Arrays { reinterpret_cast<u32*>(indices),
+                reinterpret_cast<ComponentTicks*>(ticks),
+                ticks + counts_[i] * sizeof(ComponentTicks) };
+        }
+
+        std::vector<std::byte> finish(bool compress)
+        {
+            header_.payload_size = data_.size() - sizeof(SnapshotHeader);
+            header_.stored_size = header_.payload_size;
+            if (compress) {
+                std::vector<std::byte> compressed(sizeof(SnapshotHeader));
+                lz::compress(std::span(data_).subspan(sizeof(SnapshotHeader)), compressed);
+                header_.flags |= SnapshotHeader::Compressed;
+                header_.stored_size = compressed.size() - sizeof(SnapshotHeader);
+                data_ = std::move(compressed);
+            }
+            std::memcpy(data_.data(), &header_, sizeof(header_));
+            return std::move(data_);
+        }
+
+    private:
+        SnapshotHeader header_;
+        std::vector<std::byte> data_;
+        std::vector<usize> offsets_;
+        std::vector<usize> counts_;
+    };
+
+    // Checks everything before a world is changed, so restoring cannot fail halfway or crash on a
+    // corrupted file
+    class SnapshotReader {
+    public:
+        struct Component {
+            usize id;
+            usize size;
+            std::span<const u32> indices;
+            const ComponentTicks* ticks;
+            const std::byte* values;
+        };
+
+        Tick tick = 0;
+        std::span<const u32> generations;
+        std::span<const u64> alive;
+        std::vector<Component> components;
+
+        // Returns false if data is not a snapshot of this version or has components that are not
+        // registered (with the same size) in this process
+        bool read(std::span<const std::byte> data)
+        {
+            SnapshotHeader header;
+            if (data.size() < sizeof(header)) {
+                return false;
+            }
+            std::memcpy(&header, data.data(), sizeof(header));
+            if (header.magic != SnapshotHeader::Magic || header.version != SnapshotHeader::Version
+                || header.stored_size != data.size() - sizeof(header)) {
+                return false;
+            }
+            auto payload = data.subspan(sizeof(header));
+            if (header.flags & SnapshotHeader::Compressed) {
+                // LZ4 blocks can't compress better than 255:1, so a corrupted size can't make us
+                // allocate absurd amounts of memory
+                if (header.payload_size / 255 > header.stored_size) {
+                    return false;
+                }
+                buffer_.resize(header.payload_size);
+                if (!lz::decompress(payload, buffer_)) {
+                    return false;
+                }
+                payload = buffer_;
+            } else if (header.payload_size != header.stored_size) {
+                return false;
+            } else if (reinterpret_cast<uintptr_t>(payload.data()) % alignof(u64) != 0) {
+                buffer_.assign(payload.begin(), payload.end());
+                payload = buffer_;
+            }
+
+            usize pos = 0;
+            // Returns the next array (nullptr if the payload is too short) and skips its padding
+            const auto take = [&](usize count, usize size) -> const std::byte* {
+                if (count > (payload.size() - pos) / size
+                    || snapshot_align(count * size) > payload.size() - pos) {
+                    return nullptr;
+                }
+                const auto array = payload.data() + pos;
+                pos += snapshot_align(count * size);
+                return array;
+            };
+
+            const auto num_entities = header.num_entities;
+            const auto generations_data = take(num_entities, sizeof(u32));
+            if (!generations_data) {
+                return false;
+            }
+            const auto num_words = (num_entities + 63) / 64;
+            const auto alive_data = take(num_words, sizeof(u64));
+            if (!alive_data) {
+                return false;
+            }
+            generations = { reinterpret_cast<const u32*>(generations_data), num_entities };
+            alive = { reinterpret_cast<const u64*>(alive_data), num_words };
+            if (std::find(generations.begin(), generations.end(), 0u) != generations.end()
+                || (num_entities % 64 != 0 && alive.back() >> (num_entities % 64) != 0)) {
+                return false;
+            }
+
+            components.clear();
+            ComponentMask ids;
+            std::vector<u64> seen(num_words); // To find duplicate indices
+            for (u64 c = 0; c < header.num_components; ++c) {
+                SnapshotComponent component;
+                const auto component_data = take(1, sizeof(component));
+                if (!component_data) {
+                    return false;
+                }
+                std::memcpy(&component, component_data, sizeof(component));
+                if (component.id >= MaxComponents || ids.test(component.id)
+                    || component.size == 0
+                    || component.size != component_infos()[component.id].size) {
+                    return false;
+                }
+                ids.set(component.id);
+                const auto indices = take(component.count, sizeof(u32));
+                const auto ticks
+                    = indices ? take(component.count, sizeof(ComponentTicks)) : nullptr;
+                const auto values = ticks ? take(component.count, component.size) : nullptr;
+                if (!values) {
+                    return false;
+                }
+                const auto& added = components.emplace_back(Component { component.id,
+                    component.size,
+                    { reinterpret_cast<const u32*>(indices), component.count },
+                    reinterpret_cast<const ComponentTicks*>(ticks), values });
+                if (!valid_indices(added.indices, seen)) {
+                    return false;
+                }
+            }
+            tick = header.tick;
+            return pos == payload.size();
+        }
+
+    private:
+        // Whether every index is of a live entity and there are no duplicates. seen has a bit for
+        // every entity index.
+        bool valid_indices(std::span<const u32> indices, std::vector<u64>& seen) const
+        {
+            // Ascending indices (from the pool storage) can't have duplicates
+            bool ascending = true;
+            for (usize i = 0; i < indices.size(); ++i) {
+                const auto idx = indices[i];
+                if (idx >= generations.size() || !(alive[idx / 64] & (u64(1) << (idx % 64)))) {
+                    return false;
+                }
+                ascending &= i == 0 || idx > indices[i - 1];
+            }
+            if (ascending) {
+                return true;
+            }
+            std::fill(seen.begin(), seen.end(), 0);
+            for (const auto idx : indices) {
+                const auto bit = u64(1) << (idx % 64);
+                if (seen[idx / 64] & bit) {
+                    return false;
+                }
+                seen[idx / 64] |= bit;
+            }
+            return true;
+        }
+
+        // The decompressed payload or an aligned copy
+        std::vector<std::byte> buffer_;
+    };
+}
+
+// A snapshot can only be restored if all of its components are registered in this process, which
+// happens when they are added or queried for the first time, or with this (e.g. before loading a
+// saved game)
+template <typename... Components>
+void register_components()
+{
+    (detail::register_component<Components>(), ...);
+}
+
+// A set of components with default values. Instantiating it creates entities with copies of them,
+// which is much cheaper than adding the components one by one: the entities get consecutive
+// indices, so every component is copied in a tight loop and the masks, bitsets and queries are
+// updated once for all of them (see World::instantiate).
+class Prefab {
+public:
+    struct Component {
+        usize id;
+        std::unique_ptr<std::byte[]> value;
+    };
+
+    // The reference is valid as long as the prefab
+    template <typename T, typename... Args>
+    T& add(Args&&... args)
+    {
+        // Instances are copied as bytes
+        static_assert(std::is_standard_layout_v<T> && std::is_trivially_copyable_v<T>);
+        static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+        const auto id = detail::register_component<T>();
+        assert(!mask_.test(id));
+        mask_.set(id);
+        auto& component = components_.emplace_back(
+            Component { id, std::make_unique_for_overwrite<std::byte[]>(sizeof(T)) });
+        return *new (component.value.get()) T { std::forward<Args>(args)... };
+    }
+
+    ComponentMask mask() const { return mask_; }
+
+    const std::vector<Component>& components() const { return components_; }
+
+private:
+    ComponentMask mask_;
+    std::vector<Component> components_;
+};
+
+// The bounds of an entity for for_each_pair with a Space, e.g. the x/z position and collider radius
+struct Circle {
+    float x;
+    float y;
+    float radius;
+};
+
+// A width x height space centered on the origin that wraps around at its edges (like the asteroids
+// game world), which for_each_pair divides into a grid. Positions outside of it are wrapped into
+// the grid, but two circles only overlap if they do without wrapping.
+struct Space {
+    float width;
+    float height;
+};
+
+namespace detail {
+    struct GridItem {
+        Entity entity;
+        Circle circle;
+    };
+
+    // Calls func(a, b) for every pair of circles that overlap. The circles are sorted into a
+    // uniform grid with cells that are at least as large as the largest circle, so circles that
+    // overlap are in the same or neighbouring cells. Every cell is paired with itself and the
+    // half of its neighbours that come after it (with wrapping), so every pair of neighbouring
+    // cells is visited once. The number of cells is limited to about twice the number of circles.
+    template <typename Func>
+    void for_each_overlapping_pair(std::span<const GridItem> items, Space space, Func func)
+    {
+        assert(space.width > 0.0f && space.height > 0.0f);
+        float max_radius = 0.0f;
+        for (const auto& item : items) {
+            max_radius = std::max(max_radius, item.circle.radius);
+        }
+        if (items.size() < 2 || max_radius <= 0.0f) {
+            return;
+        }
+
+        constexpr float MaxCellsPerAxis = 65536.0f;
+        auto cols = std::clamp(space.width / (2.0f * max_radius), 1.0f, MaxCellsPerAxis);
+        auto rows = std::clamp(space.height / (2.0f * max_radius), 1.0f, MaxCellsPerAxis);
+        const auto max_cells = 2.0f * static_cast<float>(items.size());
+        if (cols * rows > max_cells) {
+            const auto scale = std::sqrt(max_cells / (cols * rows));
+            cols = std::max(cols * scale, 1.0f);
+            rows = std::max(rows * scale, 1.0f);
+        }
+        // With 2 cells on an axis the neighbours on both sides would be the same cell
+        const auto num_cols = cols < 3.0f ? 1 : static_cast<usize>(cols);
+        const auto num_rows = rows < 3.0f ? 1 : static_cast<usize>(rows);
+
+        const auto cell_coord = [](float pos, float size, usize num) {
+            auto coord = (pos / size + 0.5f) * static_cast<float>(num);
+            coord -= std::floor(coord / static_cast<float>(num)) * static_cast<float>(num);
+            return std::min(static_cast<usize>(coord), num - 1);
+        };
+
+        // Counting sort by cell, so the circles of a cell are contiguous and keep their order
+        std::vector<u32> cells(items.size());
+        std::vector<u32> cell_start(num_cols * num_rows + 1, 0);
+        for (usize i = 0; i < items.size(); ++i) {
+            const auto& circle = items[i].circle;
+            cells[i] = static_cast<u32>(cell_coord(circle.y, space.height, num_rows) * num_cols
+                + cell_coord(circle.x, space.width, num_cols));
+            cell_start[cells[i] + 1]++;
+        }
+        for (usize cell = 1; cell < cell_start.size(); ++cell) {
+            cell_start[cell] += cell_start[cell - 1];
+        }
+        std::vector<GridItem> sorted(items.size());
+        auto cell_end = cell_start;
+        for (usize i = 0; i < items.size(); ++i) {
+            sorted[cell_end[cells[i]]++] = items[i];
+        }
+
+        const auto test = [&func](const GridItem& a, const GridItem& b) {
+            const auto dx = b.circle.x - a.circle.x;
+            const auto dy = b.circle.y - a.circle.y;
+            const auto radius = a.circle.radius + b.circle.radius;
+            if (dx * dx + dy * dy < radius * radius) {
+                func(a.entity, b.entity);
+            }
+        };
+        for (usize row = 0; row < num_rows; ++row) {
+            for (usize col = 0; col < num_cols; ++col) {
+                const auto cell = row * num_cols + col;
+                const auto begin = cell_start[cell];
+                const auto end = cell_start[cell + 1];
+                for (auto i = begin; i < end; ++i) {
+                    for (auto j = i + 1; j < end; ++j) {
+                        test(sorted[i], sorted[j]);
+                    }
+                }
+                if (begin == end) {
+                    continue;
+                }
+
+                // Right, bottom left, bottom and bottom right. With a single column they are the
+                // same cell or each other and with a single row only the right one is left.
+                const std::array<std::pair<usize, usize>, 4> offsets {
+                    { { 1, 0 }, { num_cols - 1, 1 }, { 0, 1 }, { 1, 1 } },
+                };
+                std::array<usize, 4> neighbours;
+                usize num_neighbours = 0;
+                for (const auto& [col_offset, row_offset] : offsets) {
+                    if (row_offset > 0 && num_rows == 1) {
+                        break;
+                    }
+                    const auto neighbour = (row + row_offset) % num_rows * num_cols
+                        + (col + col_offset) % num_cols;
+                    const auto last = neighbours.begin() + num_neighbours;
+                    if (neighbour != cell
+                        && std::find(neighbours.begin(), last, neighbour) == last) {
+                        neighbours[num_neighbours++] = neighbour;
+                    }
+                }
+                for (usize n = 0; n < num_neighbours; ++n) {
+                    for (auto i = begin; i < end; ++i) {
+                        for (auto j = cell_start[neighbours[n]]; j < cell_start[neighbours[n] + 1];
+                             ++j) {
+                            test(sorted[i], sorted[j]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+class PoolWorld {
+public:
+    static PoolWorld& instance()
+    {
+        static PoolWorld world;
+        return world;
+    }
+
+    // Entities and component pages are allocated when they are needed, so the capacity is only a
+    // hint to avoid reallocating the entity list while the world grows
+    PoolWorld(usize capacity = 1024) { reserve(capacity); }
+
+    // Copies everything, so the copy can be simulated independently (e.g. for rollback). This is a
+    // memcpy of every pool page.
+    // Must not be called while iterating.
+    PoolWorld clone() const { return PoolWorld(*this); }
+
+    void reserve(usize capacity) { entities_.reserve(capacity); }
+
+    usize capacity() const { return entities_.capacity(); }
+
+    Entity create_entity()
+    {
+        const auto idx = get_free_entity_idx();
+        if (idx == entities_.size()) {
+            entities_.push_back(EntityData { Entity(idx, 1) });
+        }
+        set_bit(alive_, idx);
+        const ComponentMask no_components;
+        update_queries(idx, nullptr, &no_components);
+        return entities_[idx].id;
+    }
+
+    // Creates count entities with copies of the prefab's components. They get consecutive
+    // indices, so the components are copied a pool page at a time and the bitsets a word at a
+    // time.
+    std::vector<Entity> instantiate(const Prefab& prefab, usize count)
+    {
+        std::vector<Entity> entities;
+        if (count == 0) {
+            return entities;
+        }
+        entities.reserve(count);
+        const auto first = get_free_entity_range(count);
+        const auto end = first + count;
+        for (usize idx = entities_.size(); idx < end; ++idx) {
+            entities_.push_back(EntityData { Entity(idx, 1) });
+        }
+        for (usize idx = first; idx < end; ++idx) {
+            entities_[idx].cmask = prefab.mask();
+            entities.push_back(entities_[idx].id);
+        }
+        set_bits(alive_, first, count);
+        const ComponentTicks ticks { tick(), tick() };
+        for (const auto& component : prefab.components()) {
+            set_bits(occupancy_[component.id], first, count);
+            auto& pool = pools_[component.id];
+            if (!pool) {
+                pool = detail::component_infos()[component.id].make_pool();
+            }
+            pool->fill(first, count, component.value.get(), ticks);
+        }
+        for (const auto& query : queries_) {
+            if (prefab.mask().contains(query->mask)) {
+                for (usize idx = first; idx < end; ++idx) {
+                    query->add(idx);
+                }
+            }
+        }
+        return entities;
+    }
+
+    // A free index already has the generation of the next entity with it, which is only handed
+    // out once it is created (unless the world was restored to a snapshot from before)
+    bool exists(Entity entity) const
+    {
+        return entity.idx() < entities_.size()
+            && entities_[entity.idx()].id.gen() == entity.gen() && test_bit(alive_, entity.idx());
+    }
+
+    void destroy_entity(Entity entity)
+    {
+        assert(exists(entity));
+        auto& data = entities_[entity.idx()];
+        data.cmask.for_each([&](usize id) {
+            clear_bit(occupancy_[id], entity.idx());
+            if (pools_[id]->storage == Storage::Sparse) {
+                pools_[id]->remove(entity.idx());
+            }
+        });
+        clear_bit(alive_, entity.idx());
+        update_queries(entity.idx(), &data.cmask, nullptr);
+        data.id = data.id.next_generation();
+        data.cmask = ComponentMask();
+        // Shrink the index range if the last index is freed, so iterating over the bitsets (when
+        // creating queries) has less to do
+        if (entity.idx() + 1 == next_entity_idx_) {
+            next_entity_idx_--;
+            while (next_entity_idx_ > 0 && free_list_.contains(next_entity_idx_ - 1)) {
+                free_list_.erase(--next_entity_idx_);
+            }
+        } else {
+            free_list_.push(entity.idx());
+        }
+    }
+
+    template <typename T, typename... Args>
+    T& add_component(Entity entity, Args&&... args)
+    {
+        // Clones and snapshots copy components as bytes
+        static_assert(std::is_standard_layout_v<T> && std::is_trivially_copyable_v<T>);
+        assert(!has_component<T>(entity));
+        const auto cmask = entities_[entity.idx()].cmask;
+        entities_[entity.idx()].cmask.set(detail::component_id<T>());
+        set_bit(occupancy_[detail::component_id<T>()], entity.idx());
+        update_queries(entity.idx(), &cmask, &entities_[entity.idx()].cmask);
+        auto& pool = get_or_create_pool<T>();
+        auto& comp = pool.emplace(entity.idx());
+        comp = T { std::forward<Args>(args)... };
+        pool.ticks(entity.idx()) = ComponentTicks { tick(), tick() };
+        return comp;
+    }
+
+    // Getting a non-const component marks it as changed, so use get_component<const T> to read
+    template <typename T>
+    T& get_component(Entity entity) const
+    {
+        assert(has_component<std::remove_const_t<T>>(entity));
+        return access<T>(pool<std::remove_const_t<T>>(), entity.idx(), tick());
+    }
+
+    template <typename T>
+    T* try_get_component(Entity entity) const
+    {
+        return has_component<std::remove_const_t<T>>(entity) ? &get_component<T>(entity) : nullptr;
+    }
+
+    template <typename T>
+    void mark_changed(Entity entity)
+    {
+        assert(has_component<T>(entity));
+        pool<T>().ticks(entity.idx()).changed = tick();
+    }
+
+    Tick tick() const { return tick_.load(std::memory_order_relaxed); }
+
+    template <typename T>
+    void remove_component(Entity entity)
+    {
+        assert(has_component<T>(entity));
+        const auto cmask = entities_[entity.idx()].cmask;
+        entities_[entity.idx()].cmask.reset(detail::component_id<T>());
+        clear_bit(occupancy_[detail::component_id<T>()], entity.idx());
+        update_queries(entity.idx(), &cmask, &entities_[entity.idx()].cmask);
+        pool<T>().remove(entity.idx());
+    }
+
+    template <typename T>
+    bool has_component(Entity entity) const
+    {
+        return exists(entity) && entities_[entity.idx()].cmask.test(detail::component_id<T>());
+    }
+
+    // For debugging
+    std::vector<ComponentMemory> memory_usage() const
+    {
+        std::vector<ComponentMemory> usage;
+        for (usize id = 0; id < MaxComponents; ++id) {
+            if (const auto& pool = pools_[id]) {
+                usage.push_back(
+                    ComponentMemory { id, count_bits(occupancy_[id]), pool->memory_usage() });
+            }
+        }
+        return usage;
+    }
+
+    // Writes the live entities and their components into a versioned binary blob (see
+    // detail::SnapshotHeader), optionally compressed. Restoring it into a world of either backend
+    // brings back the same entities (with the same ids), components and change ticks.
+    // Must not be called while iterating.
+    std::vector<std::byte> snapshot(bool compress = false) const
+    {
+        assert(iteration_depth_ == 0);
+        std::vector<detail::SnapshotWriter::Component> components;
+        for (usize id = 0; id < MaxComponents; ++id) {
+            if (const auto count = count_bits(occupancy_[id])) {
+                components.push_back({ id, detail::component_infos()[id].size, count });
+            }
+        }
+        detail::SnapshotWriter writer(tick(), entities_.size(), components);
+        const auto generations = writer.generations();
+        for (usize idx = 0; idx < entities_.size(); ++idx) {
+            generations[idx] = entities_[idx].id.gen();
+        }
+        std::copy(alive_.begin(), alive_.end(), writer.alive());
+        for (usize i = 0; i < components.size(); ++i) {
+            const auto& occupancy = occupancy_[components[i].id];
+            const auto arrays = writer.arrays(i);
+            usize count = 0;
+            for (usize word = 0; word < occupancy.size(); ++word) {
+                for (auto bits = occupancy[word]; bits; bits &= bits - 1) {
+                    arrays.indices[count++] = static_cast<u32>(word * 64 + std::countr_zero(bits));
+                }
+            }
+            pools_[components[i].id]->save(
+                { arrays.indices, count }, arrays.values, arrays.ticks);
+        }
+        return writer.finish(compress);
+    }
+
+    // Replaces everything in the world with the contents of a snapshot. Returns false and leaves
+    // the world unchanged if data is not a valid snapshot or has components that are not
+    // registered (see register_components). Component ids only match in another process if they
+    // are fixed with ECS_COMPONENT_ID.
+    // Must not be called while iterating.
+    bool restore(std::span<const std::byte> data)
+    {
+        assert(iteration_depth_ == 0);
+        detail::SnapshotReader snapshot;
+        if (!snapshot.read(data)) {
+            return false;
+        }
+
+        const auto num_entities = snapshot.generations.size();
+        entities_.resize(num_entities);
+        for (usize idx = 0; idx < num_entities; ++idx) {
+            entities_[idx]
+                = EntityData { Entity(static_cast<u32>(idx), snapshot.generations[idx]) };
+        }
+        alive_.assign(snapshot.alive.begin(), snapshot.alive.end());
+        // Like after destroy_entity, the free indices at the end are not in the free list
+        next_entity_idx_ = num_entities;
+        while (next_entity_idx_ > 0 && !test_bit(alive_, next_entity_idx_ - 1)) {
+            next_entity_idx_--;
+        }
+        free_list_ = detail::FreeList();
+        for (usize idx = 0; idx < next_entity_idx_; ++idx) {
+            if (!test_bit(alive_, idx)) {
+                free_list_.push(idx);
+            }
+        }
+
+        for (usize id = 0; id < MaxComponents; ++id) {
+            occupancy_[id].clear();
+            if (pools_[id]) {
+                pools_[id]->clear();
+            }
+        }
+        for (const auto& component : snapshot.components) {
+            auto& pool = pools_[component.id];
+            if (!pool) {
+                pool = detail::component_infos()[component.id].make_pool();
+            }
+            pool->load(component.indices, component.values, component.ticks);
+            auto& occupancy = occupancy_[component.id];
+            occupancy.resize(alive_.size());
+            for (const auto idx : component.indices) {
+                entities_[idx].cmask.set(component.id);
+                occupancy[idx / 64] |= u64(1) << (idx % 64);
+            }
+        }
+        // They are filled again when they are used
+        queries_.clear();
+        query_indices_.clear();
+        tick_ = snapshot.tick;
+        return true;
+    }
+
+    // The matching entities of every combination of components that was queried before are kept
+    // in a list, so this only visits the matches.
+    // If func takes a reference to every component (func(Entity, Components&...)), it gets them
+    // straight from the pools, otherwise it only gets the entity. Components that are only read
+    // can be declared const (for_each<Transform, const Velocity>).
+    // Entities that are created or get components inside func are not visited.
+    // With a filter (Changed or Added), only the entities that have the filter's component and
+    // match the filter are visited.
+    template <typename... Components, typename Func>
+    void for_each_entity(Func func)
+    {
+        for_each_filtered<Components...>(detail::NoFilter(), func);
+    }
+
+    template <typename... Components, detail::QueryFilter Filter, typename Func>
+    void for_each_entity(Filter filter, Func func)
+    {
+        for_each_filtered<Components...>(filter, func);
+    }
+
+    // Splits the matching entities into ranges of at least ParallelGrainSize entities, which run
+    // on the threads of pool. func must not change the world and may only use get, try_get,
+    // mark_changed and has, so structural changes have to be recorded in a CommandBuffer per
+    // thread.
+    template <typename... Components, typename Func>
+    void parallel_for_each_entity(ThreadPool& pool, Func func)
+    {
+        parallel_for_each_filtered<Components...>(pool, detail::NoFilter(), func);
+    }
+
+    template <typename... Components, detail::QueryFilter Filter, typename Func>
+    void parallel_for_each_entity(ThreadPool& pool, Filter filter, Func func)
+    {
+        parallel_for_each_filtered<Components...>(pool, filter, func);
+    }
+
+    template <typename... Components, typename Func>
+    void for_each_entity_pair(Func func)
+    {
+        const auto& query = get_query<Components...>();
+        IterationScope scope(*this);
+        const auto size = query.entities.size(); // func might create more entities
+        for (usize i = 0; i < size; ++i) {
+            if (query.entities[i] == Query::Removed) {
+                continue;
+            }
+            for (usize j = i + 1; j < size; ++j) {
+                if (query.entities[j] != Query::Removed) {
+                    func(entities_[query.entities[i]].id, entities_[query.entities[j]].id);
+                }
+            }
+        }
+    }
+
+    // Only calls func(a, b) for the pairs whose circles overlap, which bounds(Entity,
+    // const Components&...) returns for every entity. Instead of testing every pair, the circles
+    // are sorted into a grid over space (see detail::for_each_overlapping_pair), so this is
+    // roughly linear in the number of entities as long as they are spread out.
+    // The circles are taken before the first call to func, but pairs with an entity that was
+    // destroyed or lost a component in the meantime are skipped. If func moves entities, it has
+    // to test the overlap again, because the later pairs were found with the old circles.
+    template <typename... Components, typename Bounds, typename Func>
+    void for_each_entity_pair(Space space, Bounds bounds, Func func)
+    {
+        std::vector<detail::GridItem> items;
+        for_each_entity<const Components...>(
+            [&](Entity entity, const Components&... components) {
+                items.push_back(detail::GridItem { entity, bounds(entity, components...) });
+            });
+        const auto matches = [this](Entity entity) {
+            return (has_component<std::remove_const_t<Components>>(entity) && ...);
+        };
+        detail::for_each_overlapping_pair(items, space, [&](Entity a, Entity b) {
+            if (matches(a) && matches(b)) {
+                func(a, b);
+            }
+        });
+    }
+
+private:
+    static constexpr usize ParallelGrainSize = 1024;
+
+    // Components can be declared const in for_each, but they are stored without it
+    template <typename T>
+    using Pool = detail::ComponentStorageType<std::remove_const_t<T>>;
+
+    struct EntityData {
+        Entity id;
+        ComponentMask cmask = {};
+    };
+
+    // Only clone copies, so it's always explicit
+    PoolWorld(const PoolWorld& other)
+        : entities_(other.entities_)
+        , free_list_(other.free_list_)
+        , next_entity_idx_(other.next_entity_idx_)
+        , alive_(other.alive_)
+        , occupancy_(other.occupancy_)
+        , tick_(other.tick())
+    {
+        assert(other.iteration_depth_ == 0);
+        for (usize id = 0; id < MaxComponents; ++id) {
+            if (other.pools_[id]) {
+                pools_[id] = other.pools_[id]->clone();
+            }
+        }
+        std::lock_guard lock(other.queries_mutex_);
+        for (const auto& query : other.queries_) {
+            queries_.push_back(std::make_unique<Query>(*query));
+        }
+        query_indices_ = other.query_indices_;
+    }
+
+    struct Query {
+        static constexpr u32 Removed = 0xffff'ffff;
+
+        ComponentMask mask;
+        // Entity indices in the order they started matching. Entities that stop matching while
+        // iterating are replaced with Removed and the list is compacted afterwards.
+        std::vector<u32> entities;
+        // Index into entities for every entity index (or Removed)
+        std::vector<u32> positions;
+        bool dirty = false;
+
+        explicit Query(ComponentMask mask)
+            : mask(mask)
+        {
+        }
+
+        void add(usize idx)
+        {
+            if (idx >= positions.size()) {
+                positions.resize(idx + 1, Removed);
+            }
+            positions[idx] = static_cast<u32>(entities.size());
+            entities.push_back(static_cast<u32>(idx));
+        }
+
+        void remove(usize idx, bool iterating)
+        {
+            const auto pos = positions[idx];
+            positions[idx] = Removed;
+            if (iterating) {
+                entities[pos] = Removed;
+                dirty = true;
+                return;
+            }
+            if (pos + 1 < entities.size()) {
+                entities[pos] = entities.back();
+                positions[entities[pos]] = pos;
+            }
+            entities.pop_back();
+        }
+
+        // Keeps the order, so that iteration order does not depend on when entities were
+        // destroyed during iteration
+        void compact()
+        {
+            usize dst = 0;
+            for (const auto idx : entities) {
+                if (idx != Removed) {
+                    positions[idx] = static_cast<u32>(dst);
+                    entities[dst++] = idx;
+                }
+            }
+            entities.resize(dst);
+            dirty = false;
+        }
+    };
+
+    // Removing entities from queries during iteration would make it skip or repeat entities, so
+    // until the outermost for_each is done, they are only marked
+    struct IterationScope {
+        PoolWorld& world;
+
+        IterationScope(PoolWorld& world)
+            : world(world)
+        {
+            world.iteration_depth_++;
+        }
+
+        ~IterationScope()
+        {
+            if (--world.iteration_depth_ == 0) {
+                // Another system might be creating a query at the same time
+                std::lock_guard lock(world.queries_mutex_);
+                for (const auto& query : world.queries_) {
+                    if (query->dirty) {
+                        query->compact();
+                    }
+                }
+            }
+        }
+    };
+
+    // The pools are created when a component is added or queried for the first time, so afterwards
+    // getting one is as cheap as a static would be: a load from a constant offset (if the component
+    // id is constant) and no type check.
+    template <typename T>
+    Pool<T>& pool() const
+    {
+        assert(pools_[detail::component_id<T>()]);
+        return static_cast<Pool<T>&>(*pools_[detail::component_id<T>()]);
+    }
+
+    template <typename T>
+    Pool<T>& get_or_create_pool()
+    {
+        auto& pool = pools_[detail::component_id<T>()];
+        if (!pool) {
+            // So snapshots with this component can be restored
+            detail::register_component<T>();
+            pool = std::make_unique<Pool<T>>();
+        }
+        return static_cast<Pool<T>&>(*pool);
+    }
+
+    template <typename... Components>
+    const Query& get_query()
+    {
+        const auto mask = detail::component_mask<Components...>();
+        // Systems that only read components can iterate at the same time (see scheduler.hpp)
+        std::lock_guard lock(queries_mutex_);
+        const auto [it, inserted] = query_indices_.emplace(mask, queries_.size());
+        if (inserted) {
+            // for_each gets the pools of the components without checking whether they exist
+            (get_or_create_pool<Components>(), ...);
+            auto& query = *queries_.emplace_back(std::make_unique<Query>(mask));
+            for_each_match(detail::component_ids<Components...>(), next_entity_idx_,
+                [&query](usize idx) { query.add(idx); });
+        }
+        return *queries_[it->second];
+    }
+
+    template <typename... Components, typename Filter, typename Func>
+    void for_each_filtered(const Filter& filter, Func& func)
+    {
+        const auto& query = get_filtered_query<Filter, Components...>();
+        const auto last_run = start_filter(filter);
+        IterationScope scope(*this);
+        for_each_in<Components...>(query, 0, query.entities.size(), filter, last_run, func);
+    }
+
+    template <typename... Components, typename Filter, typename Func>
+    void parallel_for_each_filtered(ThreadPool& pool, const Filter& filter, Func& func)
+    {
+        const auto& query = get_filtered_query<Filter, Components...>();
+        const auto last_run = start_filter(filter);
+        IterationScope scope(*this);
+        pool.parallel_for(query.entities.size(), ParallelGrainSize, [&](usize begin, usize end) {
+            for_each_in<Components...>(query, begin, end, filter, last_run, func);
+        });
+    }
+
+    // The query has the component of the filter too
+    template <typename Filter, typename... Components>
+    const Query& get_filtered_query()
+    {
+        if constexpr (std::is_same_v<Filter, detail::NoFilter>) {
+            return get_query<std::remove_const_t<Components>...>();
+        } else {
+            return get_query<std::remove_const_t<Components>..., typename Filter::Component>();
+        }
+    }
+
+    // Returns the last run of the filter and sets it to this run
+    template <typename Filter>
+    Tick start_filter(const Filter& filter)
+    {
+        if constexpr (std::is_same_v<Filter, detail::NoFilter>) {
+            return 0;
+        } else {
+            const auto last_run = filter.last_run;
+            filter.last_run = tick_++;
+            return last_run;
+        }
+    }
+
+    // Non-const access marks the component as changed
+    template <typename T>
+    static T& access(Pool<T>& pool, usize idx, Tick tick)
+    {
+        if constexpr (!std::is_const_v<T>) {
+            pool.ticks(idx).changed = tick;
+        }
+        return pool[idx];
+    }
+
+    // Calls func for query.entities[begin, end)
+    template <typename... Components, typename Filter, typename Func>
+    void for_each_in(
+        const Query& query, usize begin, usize end, const Filter&, Tick last_run, Func& func)
+    {
+        [[maybe_unused]] const auto filter_pool = [this] {
+            if constexpr (std::is_same_v<Filter, detail::NoFilter>) {
+                return nullptr;
+            } else {
+                return &pool<typename Filter::Component>();
+            }
+        }();
+        const auto matches = [&](u32 idx) {
+            if constexpr (std::is_same_v<Filter, detail::NoFilter>) {
+                return idx != Query::Removed;
+            } else {
+                return idx != Query::Removed && Filter::matches(filter_pool->ticks(idx), last_run);
+            }
+        };
+        if constexpr (std::is_invocable_v<Func&, Entity, Components&...>) {
+            const std::tuple<Pool<Components>&...> pools(
+                pool<std::remove_const_t<Components>>()...);
+            const auto tick = this->tick();
+            for (usize i = begin; i < end; ++i) {
+                const auto idx = query.entities[i];
+                if (matches(idx)) {
+                    func(entities_[idx].id,
+                        access<Components>(std::get<Pool<Components>&>(pools), idx, tick)...);
+                }
+            }
+        } else {
+            for (usize i = begin; i < end; ++i) {
+                const auto idx = query.entities[i];
+                if (matches(idx)) {
+                    func(entities_[idx].id);
+                }
+            }
+        }
+    }
+
+    // The masks are null if the entity did not exist before or does not exist anymore
+    void update_queries(usize idx, const ComponentMask* old_cmask, const ComponentMask* new_cmask)
+    {
+        for (const auto& query : queries_) {
+            const auto matched = old_cmask && old_cmask->contains(query->mask);
+            const auto matches = new_cmask && new_cmask->contains(query->mask);
+            if (!matched && matches) {
+                query->add(idx);
+            } else if (matched && !matches) {
+                query->remove(idx, iteration_depth_ > 0);
+            }
+        }
+    }
+
+    static void set_bit(std::vector<u64>& bits, usize idx)
+    {
+        if (idx / 64 >= bits.size()) {
+            bits.resize(idx / 64 + 1);
+        }
+        bits[idx / 64] |= u64(1) << (idx % 64);
+    }
+
+    static void clear_bit(std::vector<u64>& bits, usize idx)
+    {
+        bits[idx / 64] &= ~(u64(1) << (idx % 64));
+    }
+
+    // Sets the bits [first, first + count) a word at a time
+    static void set_bits(std::vector<u64>& bits, usize first, usize count)
+    {
+        const auto end = first + count;
+        if ((end + 63) / 64 > bits.size()) {
+            bits.resize((end + 63) / 64);
+        }
+        for (usize idx = first, n = 0; idx < end; idx += n) {
+            n = std::min<usize>(64 - idx % 64, end - idx);
+            bits[idx / 64] |= (n == 64 ? ~u64(0) : (u64(1) << n) - 1) << (idx % 64);
+        }
+    }
+
+    static bool test_bit(const std::vector<u64>& bits, usize idx)
+    {
+        return idx / 64 < bits.size() && (bits[idx / 64] & (u64(1) << (idx % 64)));
+    }
+
+    static usize count_bits(const std::vector<u64>& bits)
+    {
+        usize count = 0;
+        for (const auto word : bits) {
+            count += static_cast<usize>(std::popcount(word));
+        }
+        return count;
+    }
+
+    // Bit i of the result is set if entity 64 * word + i is alive and has all the components
+    template <usize N>
+    u64 match_word(const std::array<usize, N>& ids, usize word) const
+    {
+        auto bits = alive_[word];
+        for (const auto id : ids) {
+            bits &= word < occupancy_[id].size() ? occupancy_[id][word] : 0;
+        }
+        return bits;
+    }
+
+#ifdef __AVX2__
+    // Whether none of the 256 entities starting at 64 * word match
+    template <usize N>
+    bool match_block_empty(const std::array<usize, N>& ids, usize word) const
+    {
+        auto bits = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(alive_.data() + word));
+        for (const auto id : ids) {
+            if (word + 4 > occupancy_[id].size()) {
+                return false;
+            }
+            const auto component_bits = occupancy_[id].data() + word;
+            bits = _mm256_and_si256(
+                bits, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(component_bits)));
+        }
+        return _mm256_testz_si256(bits, bits);
+    }
+#endif
+
+    // Calls func(idx) for every entity index below last that has all the components in ids.
+    // This looks at 64 entities at a time (256 with AVX2), so sparse components are cheap.
+    template <usize N, typename Func>
+    void for_each_match(const std::array<usize, N>& ids, usize last, Func&& func) const
+    {
+        const auto num_words = (last + 63) / 64;
+        for (usize word = 0; word < num_words; ++word) {
+#ifdef __AVX2__
+            if (word % 4 == 0 && word + 4 <= num_words && match_block_empty(ids, word)) {
+                word += 3;
+                continue;
+            }
+#endif
+            auto bits = match_word(ids, word);
+            if (word == last / 64) {
+                bits &= (u64(1) << (last % 64)) - 1;
+            }
+            for (; bits; bits &= bits - 1) {
+                func(word * 64 + std::countr_zero(bits));
+            }
+        }
+    }
+
+    usize get_free_entity_idx()
+    {
+        if (free_list_.empty()) {
+            return next_entity_idx_++;
+        }
+        return free_list_.pop();
+    }
+
+    usize get_free_entity_range(usize count)
+    {
+        const auto first = free_list_.pop_range(count);
+        if (first != detail::FreeList::None) {
+            return first;
+        }
+        next_entity_idx_ += count;
+        return next_entity_idx_ - count;
+    }
+
+    // With components being PODs, we don't have to worry about destroying them
+    std::vector<EntityData> entities_;
+    // I don't know if this is actually good, but it keeps the components close to each other and
+    // it's super easy to do: the lowest free index is reused first.
+    detail::FreeList free_list_;
+    usize next_entity_idx_ = 0;
+    // One bit per entity index. The bits for a component are set while the entity has it.
+    std::vector<u64> alive_;
+    std::array<std::vector<u64>, MaxComponents> occupancy_;
+    // By component id. The type of each one is Pool<T> of the component with that id.
+    std::array<std::unique_ptr<detail::PoolBase>, MaxComponents> pools_;
+    // The pointers stay valid when more queries are added
+    std::vector<std::unique_ptr<Query>> queries_;
+    std::unordered_map<ComponentMask, usize, ComponentMask::Hash> query_indices_;
+    mutable std::mutex queries_mutex_;
+    std::atomic<usize> iteration_depth_ = 0;
+    std::atomic<Tick> tick_ = 1;
+};
+
+class ArchetypeWorld {
+public:
+    // Rows per chunk. The entity ids and every component column of a chunk are arrays of this size.
+    static constexpr usize ChunkRows = 256;
+
+    static ArchetypeWorld& instance()
+    {
+        static ArchetypeWorld world;
+        return world;
+    }
+
+    ArchetypeWorld(usize capacity = 1024)
+    {
+        reserve(capacity);
+        // Entities without components
+        archetypes_.push_back(std::make_unique<Archetype>(ComponentMask()));
+        archetype_indices_.emplace(ComponentMask(), 0);
+    }
+
+    // Copies everything, so the copy can be simulated independently (e.g. for rollback). This is a
+    // memcpy of every column.
+    // Must not be called while iterating.
+    ArchetypeWorld clone() const { return ArchetypeWorld(*this); }
+
+    void reserve(usize capacity) { entities_.reserve(capacity); }
+
+    usize capacity() const { return entities_.capacity(); }
+
+    Entity create_entity()
+    {
+        const auto idx = get_free_entity_idx();
+        if (idx == entities_.size()) {
+            entities_.push_back(EntityData { Entity(idx, 1) });
+        }
+        auto& data = entities_[idx];
+        data.archetype = 0;
+        data.row = archetypes_[0]->push(data.id);
+        return data.id;
+    }
+
+    // Creates count entities with copies of the prefab's components. They get consecutive
+    // indices and rows in the prefab's archetype, so every column is filled in one loop.
+    std::vector<Entity> instantiate(const Prefab& prefab, usize count)
+    {
+        std::vector<Entity> entities;
+        if (count == 0) {
+            return entities;
+        }
+        entities.reserve(count);
+        const auto first = get_free_entity_range(count);
+        const auto archetype_idx = get_archetype(prefab.mask());
+        auto& archetype = *archetypes_[archetype_idx];
+        const auto first_row = archetype.size;
+        for (usize idx = first; idx < first + count; ++idx) {
+            if (idx == entities_.size()) {
+                entities_.push_back(EntityData { Entity(idx, 1) });
+            }
+            auto& data = entities_[idx];
+            data.cmask = prefab.mask();
+            data.archetype = archetype_idx;
+            data.row = static_cast<u32>(archetype.push(data.id));
+            entities.push_back(data.id);
+        }
+        const ComponentTicks ticks { tick(), tick() };
+        const auto end_row = first_row + count;
+        for (const auto& component : prefab.components()) {
+            const auto column = archetype.columns_by_id[component.id];
+            const auto size = archetype.columns[column].size;
+            for (usize row = first_row, rows = 0; row < end_row; row += rows) {
+                rows = std::min(end_row, (row / ChunkRows + 1) * ChunkRows) - row;
+                const auto values = archetype.component(column, row);
+                for (usize i = 0; i < rows; ++i) {
+                    std::memcpy(values + i * size, component.value.get(), size);
+                }
+                std::fill_n(&archetype.ticks(column, row), rows, ticks);
+            }
+        }
+        return entities;
+    }
+
+    // A free index already has the generation of the next entity with it, which is only handed
+    // out once it is created (unless the world was restored to a snapshot from before)
+    bool exists(Entity entity) const
+    {
+        return entity.idx() < entities_.size()
+            && entities_[entity.idx()].id.gen() == entity.gen()
+            && entities_[entity.idx()].archetype != NoArchetype;
+    }
+
+    void destroy_entity(Entity entity)
+    {
+        assert(exists(entity));
+        auto& data = entities_[entity.idx()];
+        remove_row(data.archetype, data.row);
+        data.id = data.id.next_generation();
+        data.cmask = ComponentMask();
+        data.archetype = NoArchetype;
+        free_list_.push(entity.idx());
+    }
+
+    template <typename T, typename... Args>
+    T& add_component(Entity entity, Args&&... args)
+    {
+        // Clones and snapshots copy components as bytes
+        static_assert(std::is_standard_layout_v<T> && std::is_trivially_copyable_v<T>);
+        static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+        assert(!has_component<T>(entity));
+        const auto id = detail::register_component<T>();
+        move_entity(entity, id);
+        const auto& data = entities_[entity.idx()];
+        const auto& archetype = *archetypes_[data.archetype];
+        const auto column = archetype.columns_by_id[id];
+        archetype.ticks(column, data.row) = ComponentTicks { tick(), tick() };
+        return *new (archetype.component(column, data.row)) T { std::forward<Args>(args)... };
+    }
+
+    // Getting a non-const component marks it as changed, so use get_component<const T> to read
+    template <typename T>
+    T& get_component(Entity entity) const
+    {
+        using Component = std::remove_const_t<T>;
+        assert(has_component<Component>(entity));
+        const auto& data = entities_[entity.idx()];
+        const auto& archetype = *archetypes_[data.archetype];
+        if constexpr (!std::is_const_v<T>) {
+            const auto column = archetype.columns_by_id[detail::component_id<Component>()];
+            archetype.ticks(column, data.row).changed = tick();
+        }
+        return archetype.template get<Component>(data.row);
+    }
+
+    template <typename T>
+    T* try_get_component(Entity entity) const
+    {
+        return has_component<std::remove_const_t<T>>(entity) ? &get_component<T>(entity) : nullptr;
+    }
+
+    template <typename T>
+    void mark_changed(Entity entity)
+    {
+        assert(has_component<T>(entity));
+        const auto& data = entities_[entity.idx()];
+        const auto& archetype = *archetypes_[data.archetype];
+        const auto column = archetype.columns_by_id[detail::component_id<T>()];
+        archetype.ticks(column, data.row).changed = tick();
+    }
+
+    Tick tick() const { return tick_.load(std::memory_order_relaxed); }
+
+    template <typename T>
+    void remove_component(Entity entity)
+    {
+        assert(has_component<T>(entity));
+        move_entity(entity, detail::component_id<T>());
+    }
+
+    template <typename T>
+    bool has_component(Entity entity) const
+    {
+        return exists(entity) && entities_[entity.idx()].cmask.test(detail::component_id<T>());
+    }
+
+    // For debugging. Every archetype with a component has a column for it in all of its chunks.
+    std::vector<ComponentMemory> memory_usage() const
+    {
+        std::array<ComponentMemory, MaxComponents> memory;
+        ComponentMask used;
+        for (const auto& archetype : archetypes_) {
+            for (const auto& column : archetype->columns) {
+                used.set(column.component);
+                auto& component = memory[column.component];
+                component.count += archetype->size;
+                component.bytes += archetype->chunks.size() * ChunkRows
+                    * (column.size + sizeof(ComponentTicks));
+            }
+        }
+        std::vector<ComponentMemory> usage;
+        used.for_each([&](usize id) {
+            memory[id].id = id;
+            usage.push_back(memory[id]);
+        });
+        return usage;
+    }
+
+    // Writes the live entities and their components into a versioned binary blob (see
+    // detail::SnapshotHeader), optionally compressed. Restoring it into a world of either backend
+    // brings back the same entities (with the same ids), components and change ticks.
+    // Must not be called while iterating.
+    std::vector<std::byte> snapshot(bool compress = false) const
+    {
+        assert(iteration_depth_ == 0);
+        std::array<usize, MaxComponents> counts {};
+        for (const auto& archetype : archetypes_) {
+            for (const auto& column : archetype->columns) {
+                counts[column.component] += archetype->size;
+            }
+        }
+        std::vector<detail::SnapshotWriter::Component> components;
+        std::array<usize, MaxComponents> sections; // Index into components
+        for (usize id = 0; id < MaxComponents; ++id) {
+            if (counts[id] > 0) {
+                sections[id] = components.size();
+                components.push_back({ id, detail::component_infos()[id].size, counts[id] });
+            }
+        }
+
+        detail::SnapshotWriter writer(tick(), entities_.size(), components);
+        const auto generations = writer.generations();
+        for (usize idx = 0; idx < entities_.size(); ++idx) {
+            generations[idx] = entities_[idx].id.gen();
+        }
+        // Every column of a chunk is copied with one memcpy
+        const auto alive = writer.alive();
+        std::array<usize, MaxComponents> written {};
+        for (const auto& archetype : archetypes_) {
+            for (usize chunk = 0; chunk * ChunkRows < archetype->size; ++chunk) {
+                const auto rows = std::min(ChunkRows, archetype->size - chunk * ChunkRows);
+                const auto entities = archetype->entities(chunk);
+                for (usize row = 0; row < rows; ++row) {
+                    alive[entities[row].idx() / 64] |= u64(1) << (entities[row].idx() % 64);
+                }
+                for (usize col = 0; col < archetype->columns.size(); ++col) {
+                    const auto& column = archetype->columns[col];
+                    const auto arrays = writer.arrays(sections[column.component]);
+                    auto& offset = written[column.component];
+                    for (usize row = 0; row < rows; ++row) {
+                        arrays.indices[offset + row] = entities[row].idx();
+                    }
+                    std::memcpy(arrays.values + offset * column.size,
+                        archetype->chunks[chunk].get() + column.offset, rows * column.size);
+                    std::memcpy(arrays.ticks + offset, archetype->column_ticks(col, chunk),
+                        rows * sizeof(ComponentTicks));
+                    offset += rows;
+                }
+            }
+        }
+        return writer.finish(compress);
+    }
+
+    // Replaces everything in the world with the contents of a snapshot. Returns false and leaves
+    // the world unchanged if data is not a valid snapshot or has components that are not
+    // registered (see register_components). Component ids only match in another process if they
+    // are fixed with ECS_COMPONENT_ID.
+    // Must not be called while iterating.
+    bool restore(std::span<const std::byte> data)
+    {
+        assert(iteration_depth_ == 0);
+        detail::SnapshotReader snapshot;
+        if (!snapshot.read(data)) {
+            return false;
+        }
+
+        entities_.resize(snapshot.generations.size());
+        free_list_ = detail::FreeList();
+        for (usize idx = 0; idx < entities_.size(); ++idx) {
+            entities_[idx]
+                = EntityData { Entity(static_cast<u32>(idx), snapshot.generations[idx]) };
+            if (!(snapshot.alive[idx / 64] & (u64(1) << (idx % 64)))) {
+                free_list_.push(idx);
+            }
+        }
+        for (const auto& component : snapshot.components) {
+            for (const auto idx : component.indices) {
+                entities_[idx].cmask.set(component.id);
+            }
+        }
+
+        // The archetypes (and their chunks) are kept, so restoring every frame doesn't allocate
+        for (const auto& archetype : archetypes_) {
+            archetype->size = 0;
+        }
+        ComponentMask mask;
+        u32 archetype_idx = 0;
+        for (auto& entity : entities_) {
+            if (free_list_.contains(entity.id.idx())) {
+                continue;
+            }
+            // Entities next to each other often have the same components
+            if (entity.cmask != mask) {
+                mask = entity.cmask;
+                archetype_idx = get_archetype(mask);
+            }
+            entity.archetype = archetype_idx;
+            entity.row = static_cast<u32>(archetypes_[archetype_idx]->push(entity.id));
+        }
+        // Entities with consecutive indices usually end up in consecutive rows, so runs of them are
+        // copied at once
+        for (const auto& component : snapshot.components) {
+            const auto& indices = component.indices;
+            for (usize i = 0, run = 0; i < indices.size(); i += run) {
+                const auto& entity = entities_[indices[i]];
+                const auto& archetype = *archetypes_[entity.archetype];
+                const auto column = archetype.columns_by_id[component.id];
+                const auto chunk_end = (entity.row / ChunkRows + 1) * ChunkRows;
+                run = 1;
+                while (i + run < indices.size() && entity.row + run < chunk_end
+                    && entities_[indices[i + run]].archetype == entity.archetype
+                    && entities_[indices[i + run]].row == entity.row + run) {
+                    run++;
+                }
+                std::memcpy(archetype.component(column, entity.row),
+                    component.values + i * component.size, run * component.size);
+                std::memcpy(&archetype.ticks(column, entity.row), component.ticks + i,
+                    run * sizeof(ComponentTicks));
+            }
+        }
+        tick_ = snapshot.tick;
+        return true;
+    }
+
+    // The matching archetypes of every combination of components that was queried before are kept
+    // in a list, so this only visits those.
+    // Entities that are created or get components inside func are not visited (unless they end up
+    // in an archetype that is visited later).
+    // If func takes a reference to every component (func(Entity, Components&...)), it gets them
+    // straight from the chunk arrays, otherwise it only gets the entity. Components that are only
+    // read can be declared const (for_each<Transform, const Velocity>).
+    // With a filter (Changed or Added), only the entities that have the filter's component and
+    // match the filter are visited.
+    template <typename... Components, typename Func>
+    void for_each_entity(Func func)
+    {
+        for_each_filtered<Components...>(detail::NoFilter(), func);
+    }
+
+    template <typename... Components, detail::QueryFilter Filter, typename Func>
+    void for_each_entity(Filter filter, Func func)
+    {
+        for_each_filtered<Components...>(filter, func);
+    }
+
+    // Every chunk of the matching archetypes is a work item and ranges of them (at least
+    // ParallelGrainSize entities) run on the threads of pool. func must not change the world and
+    // may only use get, try_get, mark_changed and has, so structural changes have to be recorded
+    // in a CommandBuffer per thread.
+    template <typename... Components, typename Func>
+    void parallel_for_each_entity(ThreadPool& pool, Func func)
+    {
+        parallel_for_each_filtered<Components...>(pool, detail::NoFilter(), func);
+    }
+
+    template <typename... Components, detail::QueryFilter Filter, typename Func>
+    void parallel_for_each_entity(ThreadPool& pool, Filter filter, Func func)
+    {
+        parallel_for_each_filtered<Components...>(pool, filter, func);
+    }
+
+    template <typename... Components, typename Func>
+    void for_each_entity_pair(Func func)
+    {
+        const auto& query = get_query<Components...>();
+        IterationScope scope(*this);
+        // func might create more entities
+        std::vector<std::pair<const Archetype*, usize>> matching;
+        for (const auto archetype_idx : query.archetypes) {
+            const auto& archetype = *archetypes_[archetype_idx];
+            if (archetype.size > 0) {
+                matching.emplace_back(&archetype, archetype.size);
+            }
+        }
+        for (usize a = 0; a < matching.size(); ++a) {
+            const auto [archetype_a, size_a] = matching[a];
+            for (usize i = 0; i < size_a; ++i) {
+                const auto entity_a = archetype_a->entity(i);
+                if (!entity_a) {
+                    continue;
+                }
+                for (usize b = a; b < matching.size(); ++b) {
+                    const auto [archetype_b, size_b] = matching[b];
+                    for (usize j = b == a ? i + 1 : 0; j < size_b; ++j) {
+                        const auto entity_b = archetype_b->entity(j);
+                        if (entity_b) {
+                            func(entity_a, entity_b);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Like in PoolWorld, only the pairs whose circles overlap, found with a grid over space
+    template <typename... Components, typename Bounds, typename Func>
+    void for_each_entity_pair(Space space, Bounds bounds, Func func)
+    {
+        std::vector<detail::GridItem> items;
+        for_each_entity<const Components...>(
+            [&](Entity entity, const Components&... components) {
+                items.push_back(detail::GridItem { entity, bounds(entity, components...) });
+            });
+        const auto matches = [this](Entity entity) {
+            return (has_component<std::remove_const_t<Components>>(entity) && ...);
+        };
+        detail::for_each_overlapping_pair(items, space, [&](Entity a, Entity b) {
+            if (matches(a) && matches(b)) {
+                func(a, b);
+            }
+        });
+    }
+
+private:
+    static constexpr usize ParallelGrainSize = 1024;
+    static constexpr u32 NoArchetype = 0xffff'ffff;
+    static constexpr u8 NoColumn = 0xff;
+
+    struct Column {
+        usize component;
+        usize size;
+        usize offset; // in a chunk
+        usize ticks_offset;
+        void (*relocate)(void* dst, void* src);
+        void (*copy)(void* dst, const void* src, usize count);
+    };
+
+    struct Archetype {
+        ComponentMask mask;
+        std::vector<Column> columns; // ordered by component id
+        std::array<u8, MaxComponents> columns_by_id;
+        // The archetype with the component of that id added or removed
+        std::array<u32, MaxComponents> edges;
+        std::vector<std::unique_ptr<std::byte[]>> chunks;
+        usize chunk_size = 0;
+        usize size = 0;
+        // Has rows of destroyed or moved entities, which are removed after iterating
+        bool dirty = false;
+
+        explicit Archetype(ComponentMask mask)
+            : mask(mask)
+        {
+            columns_by_id.fill(NoColumn);
+            edges.fill(NoArchetype);
+            // Every chunk starts with the entity ids, followed by the component arrays, each
+            // followed by the ticks of its components
+            usize offset = sizeof(Entity) * ChunkRows;
+            for (usize id = 0; id < MaxComponents; ++id) {
+                if (mask.test(id)) {
+                    const auto& info = detail::component_infos()[id];
+                    offset = (offset + info.align - 1) / info.align * info.align;
+                    auto ticks_offset = offset + info.size * ChunkRows;
+                    ticks_offset = (ticks_offset + alignof(ComponentTicks) - 1)
+                        / alignof(ComponentTicks) * alignof(ComponentTicks);
+                    columns_by_id[id] = static_cast<u8>(columns.size());
+                    columns.push_back(
+                        Column { id, info.size, offset, ticks_offset, info.relocate, info.copy });
+                    offset = ticks_offset + sizeof(ComponentTicks) * ChunkRows;
+                }
+            }
+            chunk_size = offset;
+        }
+
+        Entity* entities(usize chunk) const
+        {
+            return reinterpret_cast<Entity*>(chunks[chunk].get());
+        }
+
+        Entity& entity(usize row) const { return entities(row / ChunkRows)[row % ChunkRows]; }
+
+        template <typename T>
+        T* column(usize chunk) const
+        {
+            const auto column = columns_by_id[detail::component_id<T>()];
+            assert(column != NoColumn);
+            return std::launder(
+                reinterpret_cast<T*>(chunks[chunk].get() + columns[column].offset));
+        }
+
+        ComponentTicks* column_ticks(usize column, usize chunk) const
+        {
+            return std::launder(reinterpret_cast<ComponentTicks*>(
+                chunks[chunk].get() + columns[column].ticks_offset));
+        }
+
+        template <typename T>
+        ComponentTicks* column_ticks(usize chunk) const
+        {
+            const auto column = columns_by_id[detail::component_id<T>()];
+            assert(column != NoColumn);
+            return column_ticks(column, chunk);
+        }
+
+        ComponentTicks& ticks(usize column, usize row) const
+        {
+            return column_ticks(column, row / ChunkRows)[row % ChunkRows];
+        }
+
+        std::byte* component(usize column, usize row) const
+        {
+            const auto& col = columns[column];
+            return chunks[row / ChunkRows].get() + col.offset + row % ChunkRows * col.size;
+        }
+
+        template <typename T>
+        T& get(usize row) const
+        {
+            const auto column = columns_by_id[detail::component_id<T>()];
+            assert(column != NoColumn);
+            return *std::launder(reinterpret_cast<T*>(component(column, row)));
+        }
+
+        usize push(Entity entity)
+        {
+            if (size == chunks.size() * ChunkRows) {
+                chunks.push_back(std::make_unique_for_overwrite<std::byte[]>(chunk_size));
+            }
+            this->entity(size) = entity;
+            return size++;
+        }
+
+        void move_row(usize src, usize dst)
+        {
+            entity(dst) = entity(src);
+            for (usize col = 0; col < columns.size(); ++col) {
+                columns[col].relocate(component(col, dst), component(col, src));
+                ticks(col, dst) = ticks(col, src);
+            }
+        }
+
+        // Copies every column of every chunk with one copy call (a memcpy for PODs)
+        std::unique_ptr<Archetype> clone() const
+        {
+            auto archetype = std::make_unique<Archetype>(mask);
+            archetype->edges = edges;
+            for (usize chunk = 0; chunk * ChunkRows < size; ++chunk) {
+                const auto rows = std::min(ChunkRows, size - chunk * ChunkRows);
+                archetype->chunks.push_back(
+                    std::make_unique_for_overwrite<std::byte[]>(chunk_size));
+                const auto dst = archetype->chunks.back().get();
+                const auto src = chunks[chunk].get();
+                std::memcpy(dst, src, rows * sizeof(Entity));
+                for (const auto& column : columns) {
+                    column.copy(dst + column.offset, src + column.offset, rows);
+                    std::memcpy(dst + column.ticks_offset, src + column.ticks_offset,
+                        rows * sizeof(ComponentTicks));
+                }
+            }
+            archetype->size = size;
+            return archetype;
+        }
+    };
+
+    struct EntityData {
+        Entity id;
+        ComponentMask cmask = {};
+        u32 archetype = NoArchetype; // While the entity is dead
+        u32 row = 0;
+    };
+
+    // Only clone copies, so it's always explicit
+    ArchetypeWorld(const ArchetypeWorld& other)
+        : entities_(other.entities_)
+        , free_list_(other.free_list_)
+        , archetype_indices_(other.archetype_indices_)
+        , tick_(other.tick())
+    {
+        assert(other.iteration_depth_ == 0);
+        for (const auto& archetype : other.archetypes_) {
+            archetypes_.push_back(archetype->clone());
+        }
+        std::lock_guard lock(other.queries_mutex_);
+        for (const auto& query : other.queries_) {
+            queries_.push_back(std::make_unique<Query>(*query));
+        }
+        query_indices_ = other.query_indices_;
+    }
+
+    // Removing rows during iteration would make it skip or repeat entities, so until the outermost
+    // for_each is done, removed rows are only marked and the archetypes are compacted afterwards
+    struct IterationScope {
+        ArchetypeWorld& world;
+
+        IterationScope(ArchetypeWorld& world)
+            : world(world)
+        {
+            world.iteration_depth_++;
+        }
+
+        ~IterationScope()
+        {
+            if (--world.iteration_depth_ == 0 && !world.dirty_archetypes_.empty()) {
+                world.compact();
+            }
+        }
+    };
+
+    struct Query {
+        ComponentMask mask;
+        std::vector<u32> archetypes;
+    };
+
+    template <typename... Components>
+    const Query& get_query()
+    {
+        const auto mask = detail::component_mask<Components...>();
+        // Systems that only read components can iterate at the same time (see scheduler.hpp)
+        std::lock_guard lock(queries_mutex_);
+        const auto [it, inserted] = query_indices_.emplace(mask, queries_.size());
+        if (inserted) {
+            auto& query = *queries_.emplace_back(std::make_unique<Query>(Query { mask, {} }));
+            for (u32 a = 0; a < archetypes_.size(); ++a) {
+                if (archetypes_[a]->mask.contains(mask)) {
+                    query.archetypes.push_back(a);
+                }
+            }
+        }
+        return *queries_[it->second];
+    }
+
+    template <typename... Components, typename Filter, typename Func>
+    void for_each_filtered(const Filter& filter, Func& func)
+    {
+        const auto& query = get_filtered_query<Filter, Components...>();
+        const auto last_run = start_filter(filter);
+        const auto tick = this->tick();
+        IterationScope scope(*this);
+        const auto num_archetypes = query.archetypes.size();
+        for (usize a = 0; a < num_archetypes; ++a) {
+            const auto& archetype = *archetypes_[query.archetypes[a]];
+            const auto size = archetype.size;
+            for (usize chunk = 0; chunk * ChunkRows < size; ++chunk) {
+                for_each_in_chunk<Components...>(
+                    archetype, chunk, size, filter, last_run, tick, func);
+            }
+        }
+    }
+
+    template <typename... Components, typename Filter, typename Func>
+    void parallel_for_each_filtered(ThreadPool& pool, const Filter& filter, Func& func)
+    {
+        const auto& query = get_filtered_query<Filter, Components...>();
+        const auto last_run = start_filter(filter);
+        const auto tick = this->tick();
+        IterationScope scope(*this);
+        std::vector<std::pair<const Archetype*, usize>> chunks;
+        for (const auto archetype_idx : query.archetypes) {
+            const auto& archetype = *archetypes_[archetype_idx];
+            for (usize chunk = 0; chunk * ChunkRows < archetype.size; ++chunk) {
+                chunks.emplace_back(&archetype, chunk);
+            }
+        }
+        const auto grain_size = ParallelGrainSize / ChunkRows;
+        pool.parallel_for(chunks.size(), grain_size, [&](usize begin, usize end) {
+            for (usize i = begin; i < end; ++i) {
+                const auto [archetype, chunk] = chunks[i];
+                for_each_in_chunk<Components...>(
+                    *archetype, chunk, archetype->size, filter, last_run, tick, func);
+            }
+        });
+    }
+
+    // The query has the component of the filter too
+    template <typename Filter, typename... Components>
+    const Query& get_filtered_query()
+    {
+        if constexpr (std::is_same_v<Filter, detail::NoFilter>) {
+            return get_query<std::remove_const_t<Components>...>();
+        } else {
+            return get_query<std::remove_const_t<Components>..., typename Filter::Component>();
+        }
+    }
+
+    // Returns the last run of the filter and sets it to this run
+    template <typename Filter>
+    Tick start_filter(const Filter& filter)
+    {
+        if constexpr (std::is_same_v<Filter, detail::NoFilter>) {
+            return 0;
+        } else {
+            const auto last_run = filter.last_run;
+            filter.last_run = tick_++;
+            return last_run;
+        }
+    }
+
+    // A column of a chunk for typed for_each. Non-const access marks the components as changed.
+    template <typename T>
+    struct ChunkColumn {
+        T* values;
+        ComponentTicks* ticks;
+
+        ChunkColumn(const Archetype& archetype, usize chunk)
+            : values(archetype.template column<std::remove_const_t<T>>(chunk))
+            , ticks(archetype.template column_ticks<std::remove_const_t<T>>(chunk))
+        {
+        }
+
+        void mark_changed(usize row, Tick tick) const
+        {
+            if constexpr (!std::is_const_v<T>) {
+                ticks[row].changed = tick;
+            }
+        }
+
+        // Much cheaper than marking them one by one between calls of func
+        void mark_all_changed(usize rows, Tick tick) const
+        {
+            if constexpr (!std::is_const_v<T>) {
+                for (usize row = 0; row < rows; ++row) {
+                    ticks[row].changed = tick;
+                }
+            }
+        }
+    };
+
+    // Calls func for the rows of chunk that are below size (the archetype size when the iteration
+    // started)
+    template <typename... Components, typename Filter, typename Func>
+    static void for_each_in_chunk(const Archetype& archetype, usize chunk, usize size,
+        const Filter&, Tick last_run, Tick tick, Func& func)
+    {
+        const auto rows = std::min(ChunkRows, size - chunk * ChunkRows);
+        const auto entities = archetype.entities(chunk);
+        [[maybe_unused]] const ComponentTicks* filter_ticks = nullptr;
+        if constexpr (!std::is_same_v<Filter, detail::NoFilter>) {
+            filter_ticks = archetype.template column_ticks<typename Filter::Component>(chunk);
+        }
+        const auto matches = [&](usize row) {
+            if constexpr (std::is_same_v<Filter, detail::NoFilter>) {
+                return static_cast<bool>(entities[row]);
+            } else {
+                return entities[row] && Filter::matches(filter_ticks[row], last_run);
+            }
+        };
+        if constexpr (std::is_invocable_v<Func&, Entity, Components&...>) {
+            const std::tuple<ChunkColumn<Components>...> columns(
+                ChunkColumn<Components>(archetype, chunk)...);
+            // Without a filter, every row is visited (marking removed ones doesn't matter)
+            constexpr auto filtered = !std::is_same_v<Filter, detail::NoFilter>;
+            if constexpr (!filtered) {
+                (std::get<ChunkColumn<Components>>(columns).mark_all_changed(rows, tick), ...);
+            }
+            for (usize row = 0; row < rows; ++row) {
+                if (matches(row)) {
+                    if constexpr (filtered) {
+                        (std::get<ChunkColumn<Components>>(columns).mark_changed(row, tick), ...);
+                    }
+                    func(entities[row], std::get<ChunkColumn<Components>>(columns).values[row]...);
+                }
+            }
+        } else {
+            for (usize row = 0; row < rows; ++row) {
+                if (matches(row)) {
+                    func(entities[row]);
+                }
+            }
+        }
+    }
+
+    u32 get_archetype(ComponentMask mask)
+    {
+        const auto idx = static_cast<u32>(archetypes_.size());
+        const auto [it, inserted] = archetype_indices_.emplace(mask, idx);
+        if (inserted) {
+            // get_query reads the archetypes and adds queries, maybe in another system
+            std::lock_guard lock(queries_mutex_);
+            archetypes_.push_back(std::make_unique<Archetype>(mask));
+            for (const auto& query : queries_) {
+                if (mask.contains(query->mask)) {
+                    query->archetypes.push_back(idx);
+                }
+            }
+        }
+        return it->second;
+    }
+
+    // Moves the entity to the archetype with the component added (if the entity does not have it)
+    // or removed (if it does). The component of an added column is left uninitialized.
+    void move_entity(Entity entity, usize component)
+    {
+        auto& data = entities_[entity.idx()];
+        const auto src_idx = data.archetype;
+        auto dst_idx = archetypes_[src_idx]->edges[component];
+        if (dst_idx == NoArchetype) {
+            dst_idx = get_archetype(data.cmask.flipped(component));
+            archetypes_[src_idx]->edges[component] = dst_idx;
+            archetypes_[dst_idx]->edges[component] = src_idx;
+        }
+
+        const auto& src = *archetypes_[src_idx];
+        auto& dst = *archetypes_[dst_idx];
+        const auto row = dst.push(entity);
+        for (usize col = 0; col < dst.columns.size(); ++col) {
+            const auto src_col = src.columns_by_id[dst.columns[col].component];
+            if (src_col != NoColumn) {
+                dst.columns[col].relocate(
+                    dst.component(col, row), src.component(src_col, data.row));
+                dst.ticks(col, row) = src.ticks(src_col, data.row);
+            }
+        }
+        remove_row(src_idx, data.row);
+
+        data.cmask.flip(component);
+        data.archetype = dst_idx;
+        data.row = static_cast<u32>(row);
+    }
+
+    void remove_row(u32 archetype_idx, usize row)
+    {
+        auto& archetype = *archetypes_[archetype_idx];
+        if (iteration_depth_ > 0) {
+            archetype.entity(row) = Entity {};
+            if (!archetype.dirty) {
+                archetype.dirty = true;
+                dirty_archetypes_.push_back(archetype_idx);
+            }
+            return;
+        }
+
+        const auto last = archetype.size - 1;
+        if (row != last) {
+            const auto moved = archetype.entity(last);
+            archetype.move_row(last, row);
+            entities_[moved.idx()].row = static_cast<u32>(row);
+        }
+        archetype.size--;
+    }
+
+    // Keeps the order of the rows, so that iteration order does not depend on when entities were
+    // destroyed during iteration
+    void compact()
+    {
+        for (const auto archetype_idx : dirty_archetypes_) {
+            auto& archetype = *archetypes_[archetype_idx];
+            usize dst = 0;
+            for (usize row = 0; row < archetype.size; ++row) {
+                const auto entity = archetype.entity(row);
+                if (!entity) {
+                    continue;
+                }
+                if (row != dst) {
+                    archetype.move_row(row, dst);
+                    entities_[entity.idx()].row = static_cast<u32>(dst);
+                }
+                dst++;
+            }
+            archetype.size = dst;
+            archetype.dirty = false;
+        }
+        dirty_archetypes_.clear();
+    }
+
+    usize get_free_entity_idx()
+    {
+        if (free_list_.empty()) {
+            return entities_.size();
+        }
+        return free_list_.pop();
+    }
+
+    usize get_free_entity_range(usize count)
+    {
+        const auto first = free_list_.pop_range(count);
+        return first != detail::FreeList::None ? first : entities_.size();
+    }
+
+    std::vector<EntityData> entities_;
+    // Reuses the lowest free index first
+    detail::FreeList free_list_;
+    // The pointers stay valid when more archetypes are added
+    std::vector<std::unique_ptr<Archetype>> archetypes_;
+    std::unordered_map<ComponentMask, u32, ComponentMask::Hash> archetype_indices_;
+    std::vector<std::unique_ptr<Query>> queries_;
+    std::unordered_map<ComponentMask, usize, ComponentMask::Hash> query_indices_;
+    mutable std::mutex queries_mutex_;
+    std::vector<u32> dirty_archetypes_;
+    std::atomic<usize> iteration_depth_ = 0;
+    std::atomic<Tick> tick_ = 1;
+};
+
+// The free functions are in a different inline namespace for each backend, so that code using
+// either of them can be linked into the same program (e.g. gac-bench).
+#ifdef ECS_ARCHETYPE_STORAGE
+inline namespace archetype_storage {
+    using World = ArchetypeWorld;
+#else
+inline namespace pool_storage {
+    using World = PoolWorld;
+#endif
+
+    inline Entity create()
+    {
+        return World::instance().create_entity();
+    }
+
+    inline std::vector<Entity> instantiate(const Prefab& prefab, usize count)
+    {
+        return World::instance().instantiate(prefab, count);
+    }
+
+    inline bool exists(Entity entity)
+    {
+        return World::instance().exists(entity);
+    }
+
+    inline void destroy(Entity entity)
+    {
+        return World::instance().destroy_entity(entity);
+    }
+
+    template <typename T, typename... Args>
+    T& add(Entity entity, Args&&... args)
+    {
+        return World::instance().add_component<T>(entity, std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    T& get(Entity entity)
+    {
+        return World::instance().get_component<T>(entity);
+    }
+
+    template <typename T>
+    T* try_get(Entity entity)
+    {
+        return World::instance().try_get_component<T>(entity);
+    }
+
+    template <typename T>
+    void remove(Entity entity)
+    {
+        return World::instance().remove_component<T>(entity);
+    }
+
+    template <typename T>
+    bool has(Entity entity)
+    {
+        return World::instance().has_component<T>(entity);
+    }
+
+    template <typename T>
+    void mark_changed(Entity entity)
+    {
+        World::instance().mark_changed<T>(entity);
+    }
+
+    inline std::vector<ComponentMemory> memory_usage()
+    {
+        return World::instance().memory_usage();
+    }
+
+    inline std::vector<std::byte> snapshot(bool compress = false)
+    {
+        return World::instance().snapshot(compress);
+    }
+
+    inline bool restore(std::span<const std::byte> data)
+    {
+        return World::instance().restore(data);
+    }
+
+    template <typename... Components, typename Func>
+    void for_each(Func func)
+    {
+        return World::instance().for_each_entity<Components...>(std::move(func));
+    }
+
+    template <typename... Components, detail::QueryFilter Filter, typename Func>
+    void for_each(Filter filter, Func func)
+    {
+        return World::instance().for_each_entity<Components...>(filter, std::move(func));
+    }
+
+    template <typename... Components, typename Func>
+    void for_each_pair(Func func)
+    {
+        return World::instance().for_each_entity_pair<Components...>(std::move(func));
+    }
+
+    template <typename... Components, typename Bounds, typename Func>
+    void for_each_pair(Space space, Bounds bounds, Func func)
+    {
+        return World::instance().for_each_entity_pair<Components...>(
+            space, std::move(bounds), std::move(func));
+    }
+
+    template <typename... Components, typename Func>
+    void parallel_for_each(Func func, ThreadPool& pool = ThreadPool::instance())
+    {
+        return World::instance().parallel_for_each_entity<Components...>(pool, std::move(func));
+    }
+
+    template <typename... Components, detail::QueryFilter Filter, typename Func>
+    void parallel_for_each(Filter filter, Func func, ThreadPool& pool = ThreadPool::instance())
+    {
+        return World::instance().parallel_for_each_entity<Components...>(
+            pool, filter, std::move(func));
+    }
+
+    // Records structural changes and applies them later in one go (at a sync point), so they can
+    // be made while iterating without having to think about what happens to the iteration, or on
+    // multiple threads (one buffer per thread). Recording does not touch the world.
+    class CommandBuffer {
+    public:
+        // The entity is created on playback. Until then it can only be used with this buffer.
+        Entity create()
+        {
+            const auto entity = Entity(static_cast<u32>(num_created_++), Pending);
+            commands_.push_back(Command { Command::Type::Create, entity });
+            return entity;
+        }
+
+        // Like create, but the entity gets copies of the prefab's components. All entities of a
+        // prefab in this buffer are instantiated at once when the first of them would be created,
+        // so set (not add) has to be used to change their components. The prefab has to live until
+        // the playback.
+        Entity instantiate(const Prefab& prefab)
+        {
+            const auto it = std::find(prefabs_.begin(), prefabs_.end(), &prefab);
+            const auto prefab_idx = static_cast<usize>(it - prefabs_.begin());
+            if (it == prefabs_.end()) {
+                prefabs_.push_back(&prefab);
+                prefab_entities_.emplace_back();
+            }
+            const auto entity = Entity(static_cast<u32>(num_created_++), Pending);
+            prefab_entities_[prefab_idx].push_back(entity.idx());
+            commands_.push_back(Command { Command::Type::Instantiate, entity, 0, prefab_idx });
+            return entity;
+        }
+
+        void destroy(Entity entity)
+        {
+            commands_.push_back(Command { Command::Type::Destroy, entity });
+            destroyed_.insert(key(entity));
+        }
+
+        // The reference is valid until the next add<T> or set<T>
+        template <typename T, typename... Args>
+        T& add(Entity entity, Args&&... args)
+        {
+            auto& queue = get_queue<T>();
+            commands_.push_back(Command { Command::Type::Add, entity, detail::component_id<T>(),
+                queue.values.size() });
+            return queue.values.emplace_back(T { std::forward<Args>(args)... });
+        }
+
+        // Replaces a component the entity has on playback (e.g. from a prefab). The reference is
+        // valid until the next add<T> or set<T>.
+        template <typename T, typename... Args>
+        T& set(Entity entity, Args&&... args)
+        {
+            auto& queue = get_queue<T>();
+            commands_.push_back(Command { Command::Type::Set, entity, detail::component_id<T>(),
+                queue.values.size() });
+            return queue.values.emplace_back(T { std::forward<Args>(args)... });
+        }
+
+        template <typename T>
+        void remove(Entity entity)
+        {
+            get_queue<T>();
+            commands_.push_back(
+                Command { Command::Type::Remove, entity, detail::component_id<T>() });
+        }
+
+        // Whether destroy was recorded for the entity
+        bool destroys(Entity entity) const { return destroyed_.contains(key(entity)); }
+
+        bool empty() const { return commands_.empty(); }
+
+        // Applies all commands in the order they were recorded and clears the buffer. Commands for
+        // entities that do not exist anymore (e.g. destroyed twice) are skipped.
+        void playback(World& world = World::instance())
+        {
+            // By index of the pending entity
+            std::vector<Entity> created(num_created_);
+            for (const auto& command : commands_) {
+                if (command.type == Command::Type::Create) {
+                    created[command.entity.idx()] = world.create_entity();
+                    continue;
+                }
+                if (command.type == Command::Type::Instantiate) {
+                    if (!created[command.entity.idx()]) {
+                        const auto& pending = prefab_entities_[command.index];
+                        const auto entities
+                            = world.instantiate(*prefabs_[command.index], pending.size());
+                        for (usize i = 0; i < pending.size(); ++i) {
+                            created[pending[i]] = entities[i];
+                        }
+                    }
+                    continue;
+                }
+
+                const auto pending = command.entity.gen() == Pending;
+                const auto entity = pending ? created[command.entity.idx()] : command.entity;
+                if (!world.exists(entity)) {
+                    continue;
+                }
+                if (command.type == Command::Type::Destroy) {
+                    world.destroy_entity(entity);
+                } else if (command.type == Command::Type::Add) {
+                    queues_[command.component]->add(world, entity, command.index);
+                } else if (command.type == Command::Type::Set) {
+                    queues_[command.component]->set(world, entity, command.index);
+                } else if (command.type == Command::Type::Remove) {
+                    queues_[command.component]->remove(world, entity);
+                }
+            }
+            clear();
+        }
+
+        void clear()
+        {
+            commands_.clear();
+            destroyed_.clear();
+            for (auto& queue : queues_) {
+                if (queue) {
+                    queue->clear();
+                }
+            }
+            prefabs_.clear();
+            prefab_entities_.clear();
+            num_created_ = 0;
+        }
+
+    private:
+        // Generation of the entities that are created on playback
+        static constexpr u32 Pending = 0xffff'ffff;
+
+        struct Command {
+            enum class Type : u8 { Create, Instantiate, Destroy, Add, Set, Remove };
+
+            Type type;
+            Entity entity;
+            usize component = 0;
+            usize index = 0; // into the component's queue (or prefabs_ for Instantiate)
+        };
+
+        // The components to add, one queue per component type
+        struct QueueBase {
+            virtual ~QueueBase() = default;
+            virtual void add(World& world, Entity entity, usize index) = 0;
+            virtual void set(World& world, Entity entity, usize index) = 0;
+            virtual void remove(World& world, Entity entity) = 0;
+            virtual void clear() = 0;
+        };
+
+        template <typename T>
+        struct Queue : QueueBase {
+            std::vector<T> values;
+
+            void add(World& world, Entity entity, usize index) override
+            {
+                world.template add_component<T>(entity, std::move(values[index]));
+            }
+
+            void set(World& world, Entity entity, usize index) override
+            {
+                world.template get_component<T>(entity) = std::move(values[index]);
+            }
+
+            void remove(World& world, Entity entity) override
+            {
+                world.template remove_component<T>(entity);
+            }
+
+            void clear() override { values.clear(); }
+        };
+
+        // Pending entities share indices with existing ones, so the key includes the generation
+        static u64 key(Entity entity) { return (u64(entity.gen()) << 32) | entity.idx(); }
+
+        template <typename T>
+        Queue<T>& get_queue()
+        {
+            auto& queue = queues_[detail::component_id<T>()];
+            if (!queue) {
+                queue = std::make_unique<Queue<T>>();
+            }
+            return static_cast<Queue<T>&>(*queue);
+        }
+
+        std::vector<Command> commands_;
+        // The keys of the entities destroy was recorded for
+        std::unordered_set<u64> destroyed_;
+        std::array<std::unique_ptr<QueueBase>, MaxComponents> queues_;
+        std::vector<const Prefab*> prefabs_;
+        // The pending entities of every prefab
+        std::vector<std::vector<u32>> prefab_entities_;
+        usize num_created_ = 0;
+    };
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,385 @@
+#include <glm/gtx/transform.hpp>
+
+#include <glw/fmt.hpp>
+#include <glwx/transform.hpp>
+
+#include "ecs.hpp"
+#include "scheduler.hpp"
+#include "shared.hpp"
+
+namespace {
+struct Transform {
+    glwx::Transform value;
+    TransformHistory history = {};
+};
+
+struct Velocity {
+    glm::vec3 value = glm::vec3(0.0f);
+};
+
+struct Input {
+    bool accel = false;
+    float turn = 0.0f;
+    BinaryInput shoot;
+};
+
+struct KeyboardControlled { };
+
+struct Mesh {
+    MeshHandle mesh;
+    TextureHandle texture;
+};
+
+struct Asteroid {
+    float radius;
+};
+
+struct Lifetime {
+    float time;
+};
+
+struct Bullet { };
+
+using Components = ecs::ComponentList<Transform, Velocity, Input, KeyboardControlled, Mesh,
+    Asteroid, Lifetime, Bullet>;
+}
+
+// Fixed ids make the masks of all queries constant
+ECS_COMPONENT_LIST(Components);
+// Only the ship has these
+ECS_COMPONENT_STORAGE(Input, Sparse);
+ECS_COMPONENT_STORAGE(KeyboardControlled, Sparse);
+
+namespace {
+// Asteroids and bullets are created in bursts, so all of them that are created by one command
+// buffer are instantiated at once. Created in init_game, because they need the meshes.
+ecs::Prefab asteroid_prefab;
+ecs::Prefab bullet_prefab;
+
+void create_prefabs()
+{
+    asteroid_prefab = ecs::Prefab();
+    asteroid_prefab.add<Asteroid>();
+    asteroid_prefab.add<Transform>();
+    asteroid_prefab.add<Velocity>();
+    asteroid_prefab.add<Mesh>(get_asteroid_meshes()[0], get_asteroid_texture());
+
+    bullet_prefab = ecs::Prefab();
+    bullet_prefab.add<Transform>();
+    bullet_prefab.add<Velocity>();
+    bullet_prefab.add<Mesh>(get_bullet_mesh(), get_bullet_texture());
+    bullet_prefab.add<Lifetime>(1.0f);
+    bullet_prefab.add<Bullet>();
+}
+
+// Entities are only created through command buffers, so systems can create them while iterating and
+// the new entities are not visited until the next system runs.
+void create_ship(ecs::CommandBuffer& cmd)
+{
+    const auto ship = cmd.create();
+    cmd.add<Transform>(ship).value.setScale(glm::vec3(0.1f));
+    cmd.add<Velocity>(ship);
+    cmd.add<Input>(ship);
+    cmd.add<KeyboardControlled>(ship);
+    cmd.add<Mesh>(ship, get_ship_mesh(), get_ship_texture());
+}
+
+void create_asteroid(
+    ecs::CommandBuffer& cmd, const glm::vec3& position, const glm::vec3& velocity, float size)
+{
+    const auto asteroid = cmd.instantiate(asteroid_prefab);
+
+    cmd.set<Asteroid>(asteroid, size * 0.5f * 0.85f); // fudge factor for collider
+
+    auto& trafo = cmd.set<Transform>(asteroid).value;
+    trafo.setPosition(position);
+    trafo.setScale(size);
+    std::array<float, 4> quat;
+    randf(quat, -1.0f, 1.0f);
+    const auto orientation = glm::quat(quat[0], quat[1], quat[2], quat[3]);
+    trafo.setOrientation(glm::normalize(orientation));
+
+    cmd.set<Velocity>(asteroid, velocity);
+
+    const auto meshes = get_asteroid_meshes();
+    const auto mesh_idx = randi(0, meshes.size() - 1);
+    cmd.set<Mesh>(asteroid, meshes[mesh_idx], get_asteroid_texture());
+}
+
+void create_asteroid(ecs::CommandBuffer& cmd)
+{
+    const auto edge = (randi(0, 1) * 2 - 1) * 0.4f * view_bounds_size;
+    const auto axis_pos = randf(-0.5f, 0.5f) * view_bounds_size;
+    const auto pos
+        = randb() ? glm::vec3(axis_pos.x, 0.0f, edge.y) : glm::vec3(edge.x, 0.0f, axis_pos.y);
+
+    const auto angle = randf(0.0f, glm::pi<float>() * 2.0f);
+    const auto speed = randf(1.0f, 3.0f);
+    const auto vel = glm::vec3(glm::cos(angle), 0.0f, glm::sin(angle)) * speed;
+
+    const auto size = randf(1.0f, 5.0f);
+
+    create_asteroid(cmd, pos, vel, size);
+}
+
+void create_bullet(ecs::CommandBuffer& cmd, const glwx::Transform& ship_trafo)
+{
+    const auto bullet = cmd.instantiate(bullet_prefab);
+
+    auto& trafo = cmd.set<Transform>(bullet, ship_trafo).value;
+    trafo.setScale(glm::vec3(1.0f));
+    trafo.move(-trafo.getForward() * 0.5f); // move bullet slightly in front of the ship
+    cmd.set<Velocity>(bullet, -trafo.getForward() * 20.0f);
+}
+
+void sys_save_transforms()
+{
+    SystemTimer timer("sys_save_transforms");
+    ecs::for_each<Transform>(
+        [](ecs::Entity, Transform& transform) { transform.history.save(transform.value); });
+}
+
+void sys_set_input(float)
+{
+    SystemTimer timer("sys_set_input");
+    ecs::for_each<Input, const KeyboardControlled>(
+        [](ecs::Entity, Input& input, const KeyboardControlled&) {
+            const auto player_input = get_player_input();
+
+            input.accel = player_input.accel;
+            input.turn = player_input.turn();
+            input.shoot.update(player_input.shoot);
+        });
+}
+
+void sys_control(float dt)
+{
+    SystemTimer timer("sys_control");
+    static ecs::CommandBuffer cmd;
+    ecs::for_each<Transform, Velocity, Input>(
+        [dt](ecs::Entity, Transform& transform, Velocity& velocity, Input& input) {
+            if (input.accel) {
+                velocity.value += -transform.value.getForward() * dt * 2.0f;
+            }
+
+            const auto turn = glm::angleAxis(
+                input.turn * glm::pi<float>() * 2.0f * dt, glm::vec3(0.0f, 1.0f, 0.0f) * 0.5f);
+            transform.value.setOrientation(turn * transform.value.getOrientation());
+
+            if (input.shoot.pressed()) {
+                create_bullet(cmd, transform.value);
+            }
+        });
+    cmd.playback();
+}
+
+void sys_physics(float dt)
+{
+    SystemTimer timer("sys_physics");
+    ecs::parallel_for_each<Transform, const Velocity>(
+        [dt](ecs::Entity, Transform& transform, const Velocity& velocity) {
+            auto pos = transform.value.getPosition() + velocity.value * dt;
+
+            if (pos.x < -view_bounds_size.x * 0.5f) {
+                pos.x += view_bounds_size.x;
+            }
+            if (pos.x > view_bounds_size.x * 0.5f) {
+                pos.x -= view_bounds_size.x;
+            }
+            if (pos.z < -view_bounds_size.y * 0.5f) {
+                pos.z += view_bounds_size.y;
+            }
+            if (pos.z > view_bounds_size.y * 0.5f) {
+                pos.z -= view_bounds_size.y;
+            }
+            transform.value.setPosition(pos);
+        });
+}
+
+void sys_render(float alpha)
+{
+    SystemTimer timer("sys_render");
+    const auto shader = get_shader();
+    std::array<Uniform, 1> uniforms {
+        Uniform { uniform_location(get_shader(), "u_texture"), TextureHandle {} },
+    };
+    ecs::for_each<const Transform, const Mesh>(
+        [&](ecs::Entity, const Transform& transform, const Mesh& mesh) {
+            uniforms[0].value = mesh.texture;
+            draw(shader, mesh.mesh, transform.history.interpolate(transform.value, alpha),
+                uniforms);
+        });
+}
+
+void sys_collide_asteroids()
+{
+    SystemTimer timer("sys_collide_asteroids");
+    ecs::for_each<Transform, Velocity, const Asteroid>(
+        [&](ecs::Entity a, Transform& a_trafo, Velocity& a_velocity, const Asteroid& a_asteroid) {
+            const auto a_radius = a_asteroid.radius;
+            ecs::for_each<Transform, Velocity, const Asteroid>(
+                [&](ecs::Entity b, Transform& b_trafo, Velocity& b_velocity,
+                    const Asteroid& b_asteroid) {
+                    if (a == b) {
+                        return;
+                    }
+
+                    const auto b_radius = b_asteroid.radius;
+                    const auto rel = b_trafo.value.getPosition() - a_trafo.value.getPosition();
+                    if (glm::dot(rel, rel) < (a_radius + b_radius) * (a_radius + b_radius)) {
+                        collide_spheres(a_trafo.value, a_velocity.value, a_radius, b_trafo.value,
+                            b_velocity.value, b_radius);
+                    }
+                });
+        });
+}
+
+void sys_shoot_asteroids()
+{
+    SystemTimer timer("sys_shoot_asteroids");
+    // This used to be a good example of something a naive ECS cannot do well: we destroy bullets
+    // and asteroids and create new asteroids while iterating over them and there was no easy way
+    // to know whether the new asteroids would be iterated over now or not.
+    // Now all of that is recorded in a command buffer and played back after the loops, which is
+    // essentially the "queue an event and respond to it later" I wanted. An asteroid that is
+    // already destroyed (in the command buffer) is still iterated over though, so it has to be
+    // skipped, and for_each can't break, so we still need a flag to stop after the first hit.
+    constexpr auto bullet_radius = 1.0f;
+    static ecs::CommandBuffer cmd;
+    ecs::for_each<Transform, Velocity, Bullet>(
+        [&](ecs::Entity bullet, Transform& bullet_trafo, Velocity& bullet_velocity, Bullet&) {
+            const auto bullet_pos = bullet_trafo.value.getPosition();
+            const auto bullet_vel = bullet_velocity.value;
+            bool hit = false;
+            ecs::for_each<Transform, Velocity, Asteroid>(
+                [&](ecs::Entity asteroid, Transform& trafo, Velocity& velocity, Asteroid& comp) {
+                    if (hit || cmd.destroys(asteroid)) {
+                        return;
+                    }
+
+                    const auto asteroid_pos = trafo.value.getPosition();
+                    const auto asteroid_vel = velocity.value;
+                    const auto asteroid_radius = comp.radius;
+
+                    const auto rel = asteroid_pos - bullet_pos;
+                    const auto total_radius = asteroid_radius + bullet_radius;
+                    if (glm::dot(rel, rel) < total_radius * total_radius) {
+                        hit = true;
+                        cmd.destroy(asteroid);
+
+                        if (asteroid_radius < 0.5f) {
+                            return;
+                        }
+
+                        const auto ortho
+                            = glm::normalize(glm::vec3(-bullet_vel.z, 0.0f, bullet_vel.x));
+                        // 1/(2^(1/3)) times the origional radius should yield half the volume.
+                        const auto radius = asteroid_radius * 0.8f;
+                        for (size_t i = 0; i < 2; ++i) {
+                            const auto dir = static_cast<float>(i) * 2.0f - 1.0f;
+                            const auto pos = asteroid_pos + dir * ortho * radius;
+                            const auto vel
+                                = (asteroid_vel + dir * ortho * glm::length(asteroid_vel));
+                            create_asteroid(cmd, pos, vel, radius * 2.0f);
+                        }
+                    }
+                });
+            if (hit) {
+                cmd.destroy(bullet);
+            }
+        });
+    cmd.playback();
+}
+
+void sys_lifetime(float dt)
+{
+    SystemTimer timer("sys_lifetime");
+    // One list of expired entities per thread. Which thread gets which entities depends on the
+    // work stealing, so they are sorted before they are destroyed. Otherwise the order the entity
+    // indices are reused in (and the order of the queries) would differ between runs.
+    auto& pool = ThreadPool::instance();
+    static std::vector<std::vector<ecs::Entity>> expired(pool.num_threads());
+    ecs::parallel_for_each<Lifetime>([&](ecs::Entity entity, Lifetime& lifetime) {
+        lifetime.time -= dt;
+        if (lifetime.time <= 0.0f) {
+            expired[pool.thread_index()].push_back(entity);
+        }
+    });
+    static std::vector<ecs::Entity> destroyed;
+    for (auto& entities : expired) {
+        destroyed.insert(destroyed.end(), entities.begin(), entities.end());
+        entities.clear();
+    }
+    std::sort(destroyed.begin(), destroyed.end(),
+        [](ecs::Entity a, ecs::Entity b) { return a.idx() < b.idx(); });
+    for (const auto entity : destroyed) {
+        ecs::destroy(entity);
+    }
+    destroyed.clear();
+}
+
+ecs::Scheduler scheduler;
+
+void init_game(const GameConfig& config)
+{
+    // Added in the order they used to be called in. The ones that create or destroy entities run
+    // alone, everything else runs as soon as the systems it conflicts with are done.
+    scheduler.add<Transform>("sys_save_transforms", [](float) { sys_save_transforms(); });
+    scheduler.add<Input, const KeyboardControlled>("sys_set_input", sys_set_input);
+    scheduler.add_exclusive("sys_control", sys_control);
+    scheduler.add<Transform, Velocity, const Asteroid>(
+        "sys_collide_asteroids", [](float) { sys_collide_asteroids(); });
+    scheduler.add<Transform, const Velocity>("sys_physics", sys_physics);
+    scheduler.add_exclusive("sys_lifetime", sys_lifetime);
+    scheduler.add_exclusive("sys_shoot_asteroids", [](float) { sys_shoot_asteroids(); });
+
+    create_prefabs();
+    ecs::CommandBuffer cmd;
+    create_ship(cmd);
+
+    for (size_t i = 0; i < config.num_asteroids; ++i) {
+        create_asteroid(cmd);
+    }
+    cmd.playback();
+}
+
+void update_game(float dt)
+{
+    scheduler.run(dt);
+}
+
+void render_game(float alpha)
+{
+    sys_render(alpha);
+}
+
+void shutdown_game()
+{
+    scheduler.clear();
+
+    // Every entity has a transform
+    ecs::for_each<Transform>([](ecs::Entity entity) { ecs::destroy(entity); });
+}
+}
+
+#ifdef ECS_ARCHETYPE_STORAGE
+namespace classic_ecs_archetype {
+#else
+namespace classic_ecs {
+#endif
+const Game& get_game()
+{
+    static const Game game {
+#ifdef ECS_ARCHETYPE_STORAGE
+        .name = "classic-ecs-archetype",
+#else
+        .name = "classic-ecs",
+#endif
+        .init = init_game,
+        .update = update_game,
+        .render = render_game,
+        .shutdown = shutdown_game,
+    };
+    return game;
+}
+}
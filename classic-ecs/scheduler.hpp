@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "ecs.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
+
+namespace ecs {
+// Runs systems as if they were called one after another in the order they were added, but systems
+// that do not conflict run at the same time on a thread pool.
+// Every system declares the components it accesses (const ones are only read). Two systems
+// conflict if one of them writes a component the other one accesses, so the later one depends on
+// the earlier one. Systems that make structural changes (create, destroy, add, remove, playing
+// back command buffers) or use other state that is not thread-safe (e.g. the random number
+// generator) have to be added as exclusive, which makes them conflict with every other system.
+// Exclusive systems run on the thread that calls run, so they use its thread_local random number
+// generator (the one seed_rng seeds) and the results don't depend on the pool's threads.
+// Dependencies that are not visible from the component access can be added explicitly.
+class Scheduler {
+public:
+    using SystemFunc = std::function<void(float dt)>;
+
+    struct System {
+        const char* name = nullptr;
+        SystemFunc func;
+        ComponentMask reads;
+        ComponentMask writes;
+        bool exclusive = false;
+        // The systems that have to finish before this one starts (indices into systems())
+        std::vector<usize> dependencies;
+
+        // Of the last run, relative to its start
+        u64 start_ns = 0;
+        u64 end_ns = 0;
+        usize thread = 0; // ThreadPool::thread_index
+    };
+
+    // Returns the index of the system
+    template <typename... Components>
+    usize add(const char* name, SystemFunc func)
+    {
+        System system;
+        system.name = name;
+        system.func = std::move(func);
+        system.reads = access_mask<Components...>(true);
+        system.writes = access_mask<Components...>(false);
+        return insert(std::move(system));
+    }
+
+    usize add_exclusive(const char* name, SystemFunc func)
+    {
+        System system;
+        system.name = name;
+        system.func = std::move(func);
+        system.exclusive = true;
+        return insert(std::move(system));
+    }
+
+    // system will not start before dependency is done. dependency has to be added before system.
+    void add_dependency(usize system, usize dependency)
+    {
+        assert(dependency < system && system < systems_.size());
+        auto& dependencies = systems_[system].dependencies;
+        if (std::find(dependencies.begin(), dependencies.end(), dependency) == dependencies.end()) {
+            dependencies.push_back(dependency);
+        }
+    }
+
+    void clear() { systems_.clear(); }
+
+    // The graph (dependencies) and the timings of the last run
+    std::span<const System> systems() const { return systems_; }
+
+    void run(float dt, ThreadPool& pool = ThreadPool::instance())
+    {
+        // An exclusive system depends on every system before it and every system after it depends
+        // on it, so they split the others into groups that run one after another
+        const auto start = get_time_ns();
+        for (usize begin = 0; begin < systems_.size();) {
+            if (systems_[begin].exclusive) {
+                run_system(systems_[begin], dt, start, pool);
+                begin++;
+                continue;
+            }
+            auto end = begin;
+            while (end < systems_.size() && !systems_[end].exclusive) {
+                end++;
+            }
+            run_parallel(begin, end, dt, start, pool);
+            begin = end;
+        }
+    }
+
+private:
+    void run_system(System& system, float dt, u64 start, ThreadPool& pool)
+    {
+        system.thread = pool.thread_index();
+        system.start_ns = get_time_ns() - start;
+        system.func(dt);
+        system.end_ns = get_time_ns() - start;
+    }
+
+    // Runs the systems in [begin, end), none of which are exclusive, on the pool. Their
+    // dependencies before begin are done already.
+    void run_parallel(usize begin, usize end, float dt, u64 start, ThreadPool& pool)
+    {
+        // The number of dependencies that are not done yet and the reverse edges
+        std::vector<std::atomic<usize>> waiting(end - begin);
+        std::vector<std::vector<usize>> dependents(end - begin);
+        std::vector<usize> ready;
+        for (usize i = begin; i < end; ++i) {
+            for (const auto dependency : systems_[i].dependencies) {
+                if (dependency >= begin) {
+                    waiting[i - begin]++;
+                    dependents[dependency - begin].push_back(i);
+                }
+            }
+            if (waiting[i - begin] == 0) {
+                ready.push_back(i);
+            }
+        }
+
+        ThreadPool::Counter counter = 0;
+        // A system submits the systems that only waited for it
+        std::function<void(usize)> submit = [&](usize idx) {
+            pool.submit(counter, [&, idx] {
+                run_system(systems_[idx], dt, start, pool);
+                for (const auto dependent : dependents[idx - begin]) {
+                    if (--waiting[dependent - begin] == 0) {
+                        submit(dependent);
+                    }
+                }
+            });
+        };
+        for (const auto idx : ready) {
+            submit(idx);
+        }
+        pool.wait(counter);
+    }
+
+    // The mask of the components that are const (read) or not
+    template <typename... Components>
+    static ComponentMask access_mask(bool read)
+    {
+        return ((std::is_const_v<Components> == read
+                        ? detail::component_mask<std::remove_const_t<Components>>()
+                        : ComponentMask())
+            | ... | ComponentMask());
+    }
+
+    static bool conflict(const System& a, const System& b)
+    {
+        return a.exclusive || b.exclusive || a.writes.intersects(b.reads | b.writes)
+            || b.writes.intersects(a.reads);
+    }
+
+    usize insert(System system)
+    {
+        // Depending on a system that this one depends on indirectly already is redundant, so going
+        // backwards, skip every system that is a dependency of one that we already depend on.
+        const auto idx = systems_.size();
+        std::vector<bool> reachable(idx, false);
+        for (usize i = idx; i-- > 0;) {
+            if (reachable[i]) {
+                for (const auto dependency : systems_[i].dependencies) {
+                    reachable[dependency] = true;
+                }
+            } else if (conflict(system, systems_[i])) {
+                system.dependencies.push_back(i);
+                reachable[i] = true;
+                for (const auto dependency : systems_[i].dependencies) {
+                    reachable[dependency] = true;
+                }
+            }
+        }
+        systems_.push_back(std::move(system));
+        return idx;
+    }
+
+    std::vector<System> systems_;
+};
+}
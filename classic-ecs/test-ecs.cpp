@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstdio>
+#include <vector>
 
 #include "ecs.hpp"
+#include "scheduler.hpp"
 
 struct Position {
     float x;
@@ -13,6 +18,20 @@ struct Sprite {
     u64 texture;
 };
 
+struct Health {
+    float value;
+};
+
+struct Target {
+    u32 value;
+};
+
+using TestComponents = ecs::ComponentList<Health, Target>;
+ECS_COMPONENT_LIST(TestComponents);
+ECS_COMPONENT_ID(Sprite, 2);
+
+ECS_COMPONENT_STORAGE(Target, Sparse);
+
 int main()
 {
     const auto ent1 = ecs::create();
@@ -56,4 +75,458 @@ int main()
         std::printf("Entity (%d, %d) Position: %f, %f, Sprite: %f, %f, %lu\n", entity.idx(),
             entity.gen(), pos.x, pos.y, sprite.w, sprite.h, sprite.texture);
     });
-}
\ No newline at end of file
+
+    // Pools grow in pages without moving the components that are already there
+    [[maybe_unused]] auto& pos3 = ecs::get<Position>(ent3);
+    std::vector<ecs::Entity> entities;
+    for (usize i = 0; i < 100'000; ++i) {
+        entities.push_back(ecs::create());
+        ecs::add<Position>(entities.back(), static_cast<float>(i), 0.0f);
+    }
+#ifndef ECS_ARCHETYPE_STORAGE
+    assert(&pos3 == &ecs::get<Position>(ent3));
+#endif
+    usize num_positions = 0;
+    ecs::for_each<Position>([&num_positions](ecs::Entity) { num_positions++; });
+    assert(num_positions == entities.size() + 1);
+    for (usize i = 0; i < entities.size(); ++i) {
+        assert(ecs::get<Position>(entities[i]).x == static_cast<float>(i));
+        ecs::destroy(entities[i]);
+    }
+    std::printf("many entities\n");
+
+    // Components keep their values when other components are added or removed (which moves them
+    // to another archetype) and when other entities are destroyed during iteration
+    std::vector<ecs::Entity> sprites;
+    for (usize i = 0; i < 1000; ++i) {
+        sprites.push_back(ecs::create());
+        ecs::add<Position>(sprites.back(), static_cast<float>(i), 0.0f);
+        if (i % 3 == 0) {
+            ecs::add<Sprite>(sprites.back(), static_cast<float>(i), 0.0f, i);
+        }
+    }
+    usize num_visited = 0;
+    ecs::for_each<Position>([&num_visited](ecs::Entity entity) {
+        num_visited++;
+        const auto i = static_cast<u64>(ecs::get<Position>(entity).x);
+        if (i % 2 == 0) {
+            ecs::destroy(entity);
+        } else if (i % 3 == 0) {
+            ecs::remove<Sprite>(entity);
+        }
+    });
+    assert(num_visited == sprites.size() + 1);
+    for (usize i = 0; i < sprites.size(); ++i) {
+        assert(ecs::exists(sprites[i]) == (i % 2 != 0));
+        if (i % 2 != 0) {
+            assert(ecs::get<Position>(sprites[i]).x == static_cast<float>(i));
+            assert(!ecs::has<Sprite>(sprites[i]));
+            ecs::destroy(sprites[i]);
+        }
+    }
+    std::printf("destroy during iteration\n");
+
+    // Components passed to func are the same ones ecs::get returns
+    const auto ent4 = ecs::create();
+    ecs::add<Position>(ent4, 7.0f, 8.0f);
+    ecs::add<Sprite>(ent4, 1.0f, 1.0f, 2_u64);
+    usize num_sprites = 0;
+    ecs::for_each<Position, Sprite>([&](ecs::Entity entity, Position& pos, Sprite& sprite) {
+        assert(&pos == &ecs::get<Position>(entity));
+        assert(&sprite == &ecs::get<Sprite>(entity));
+        pos.x += sprite.w;
+        num_sprites++;
+    });
+    assert(num_sprites == 2);
+    assert(ecs::get<Position>(ent3).x == 105.0f);
+    assert(ecs::get<Position>(ent4).x == 8.0f);
+    std::printf("typed for_each\n");
+
+    // Command buffers only touch the world on playback
+    ecs::CommandBuffer cmd;
+    usize num_recorded = 0;
+    ecs::for_each<Position>([&](ecs::Entity entity, Position& pos) {
+        const auto ent = cmd.create();
+        cmd.add<Position>(ent, pos.x + 100.0f, 0.0f);
+        cmd.add<Sprite>(ent, 1.0f, 1.0f, 3_u64).w = 2.0f;
+        cmd.destroy(entity);
+        num_recorded++;
+    });
+    cmd.destroy(ent4); // twice
+    cmd.remove<Sprite>(ent4);
+    assert(num_recorded == 2 && cmd.destroys(ent4) && !cmd.destroys(ent1));
+    assert(ecs::exists(ent3) && ecs::exists(ent4));
+    cmd.playback();
+    assert(cmd.empty() && !cmd.destroys(ent4) && !ecs::exists(ent3) && !ecs::exists(ent4));
+    usize num_created = 0;
+    ecs::for_each<Position, Sprite>([&](ecs::Entity entity, Position& pos, Sprite& sprite) {
+        assert(pos.x == 205.0f || pos.x == 108.0f);
+        assert(sprite.w == 2.0f && sprite.texture == 3);
+        ecs::destroy(entity);
+        num_created++;
+    });
+    assert(num_created == 2);
+    std::printf("command buffer\n");
+
+    // Every entity is visited exactly once, no matter which thread gets it
+    ThreadPool pool(4);
+    std::vector<ecs::CommandBuffer> thread_cmds(pool.num_threads());
+    std::vector<ecs::Entity> parallel;
+    for (usize i = 0; i < 10000; ++i) {
+        parallel.push_back(ecs::create());
+        ecs::add<Position>(parallel.back(), static_cast<float>(i), 0.0f);
+        ecs::add<Sprite>(parallel.back(), 1.0f, 0.0f, i);
+    }
+    std::atomic<usize> num_parallel = 0;
+    ecs::parallel_for_each<Position, const Sprite>(
+        [&](ecs::Entity entity, Position& pos, const Sprite& sprite) {
+            pos.y += sprite.w;
+            if (sprite.texture % 2 == 0) {
+                thread_cmds[pool.thread_index()].destroy(entity);
+            }
+            num_parallel++;
+        },
+        pool);
+    assert(num_parallel == parallel.size());
+    for (auto& thread_cmd : thread_cmds) {
+        thread_cmd.playback();
+    }
+    for (usize i = 0; i < parallel.size(); ++i) {
+        assert(ecs::exists(parallel[i]) == (i % 2 != 0));
+        if (i % 2 != 0) {
+            assert(ecs::get<Position>(parallel[i]).y == 1.0f);
+            ecs::destroy(parallel[i]);
+        }
+    }
+    std::printf("parallel for_each\n");
+
+    // Systems that only read the same components do not depend on each other and only direct
+    // dependencies are kept
+    ecs::Scheduler scheduler;
+    std::atomic<usize> num_runs = 0;
+    const auto count_run = [&num_runs](float) { num_runs++; };
+    const auto read_a = scheduler.add<const Position>("read_a", count_run);
+    const auto read_b = scheduler.add<const Position, Sprite>("read_b", count_run);
+    const auto write = scheduler.add<Position>("write", count_run);
+    const auto exclusive = scheduler.add_exclusive("exclusive", count_run);
+    scheduler.add<const Sprite>("last", count_run);
+    const auto systems = scheduler.systems();
+    assert(systems[read_a].dependencies.empty() && systems[read_b].dependencies.empty());
+    assert(systems[write].dependencies == std::vector<usize>({ read_b, read_a }));
+    assert(systems[exclusive].dependencies == std::vector<usize>({ write }));
+    assert(systems.back().dependencies == std::vector<usize>({ exclusive }));
+    scheduler.run(0.0f, pool);
+    assert(num_runs == systems.size());
+    // Exclusive systems run on the thread that called run
+    assert(systems[exclusive].thread == pool.thread_index());
+    for (const auto& system : systems) {
+        for (const auto dependency : system.dependencies) {
+            assert(system.start_ns >= systems[dependency].end_ns);
+        }
+    }
+    std::printf("scheduler\n");
+
+    // Registered ids are constant, the others count down from the end and masks have room for all
+    static_assert(ecs::detail::component_id<Health>() == 0);
+    static_assert(ecs::detail::component_id<Target>() == 1);
+    static_assert(ecs::detail::component_id<Sprite>() == 2);
+    static_assert(ecs::detail::constant_component_mask<Health>.test(0));
+    static_assert(ecs::detail::constant_component_mask<Target, Sprite>.test(1)
+        && ecs::detail::constant_component_mask<Target, Sprite>.test(2));
+    assert(ecs::detail::component_id<Position>() == ecs::MaxComponents - 1);
+    const auto health_mask = ecs::detail::component_mask<Health, Position>();
+    assert(health_mask.contains(ecs::detail::component_mask<Position>()));
+    assert(!ecs::detail::component_mask<Position>().contains(health_mask));
+    assert(!health_mask.contains(ecs::ComponentMask().flipped(ecs::MaxComponents / 2)));
+    const auto ent5 = ecs::create();
+    ecs::add<Health>(ent5, 10.0f);
+    ecs::add<Position>(ent5, 1.0f, 2.0f);
+    usize num_health = 0;
+    ecs::for_each<Health, const Position>([&](ecs::Entity, Health& health, const Position& pos) {
+        health.value -= pos.y;
+        num_health++;
+    });
+    assert(num_health == 1 && ecs::get<Health>(ent5).value == 8.0f);
+    ecs::destroy(ent5);
+    std::printf("component masks\n");
+
+    // The lowest free index is reused first and old handles stay invalid
+    const auto recycle_a = ecs::create();
+    const auto recycle_b = ecs::create();
+    const auto recycle_c = ecs::create();
+    ecs::destroy(recycle_b);
+    ecs::destroy(recycle_c);
+    const auto recycle_d = ecs::create();
+    assert(recycle_d.idx() == recycle_b.idx() && recycle_d != recycle_b);
+    assert(!ecs::exists(recycle_b) && !ecs::exists(recycle_c) && ecs::exists(recycle_d));
+    const auto recycle_e = ecs::create();
+    assert(recycle_e.idx() == recycle_c.idx() && recycle_e != recycle_c);
+    ecs::destroy(recycle_a);
+    ecs::destroy(recycle_d);
+    ecs::destroy(recycle_e);
+    std::printf("entity recycling\n");
+
+    // Removing from a sparse set moves the last component, which must stay with its entity
+    std::vector<ecs::Entity> targets;
+    for (u32 i = 0; i < 100; ++i) {
+        targets.push_back(ecs::create());
+        if (i % 3 == 0) {
+            ecs::add<Target>(targets.back(), i);
+        }
+    }
+    ecs::remove<Target>(targets[0]);
+    ecs::destroy(targets[3]);
+    usize num_targets = 0;
+    ecs::for_each<const Target>([&](ecs::Entity entity, const Target& target) {
+        assert(entity == targets[target.value]);
+        num_targets++;
+    });
+    assert(num_targets == 32 && !ecs::has<Target>(targets[0]));
+    const auto target_id = ecs::detail::component_id<Target>();
+    const auto usage = ecs::memory_usage();
+    const auto target_usage = std::find_if(usage.begin(), usage.end(),
+        [target_id](const ecs::ComponentMemory& memory) { return memory.id == target_id; });
+    assert(target_usage != usage.end() && target_usage->count == 32);
+    assert(target_usage->bytes >= 32 * sizeof(Target));
+    for (const auto entity : targets) {
+        if (ecs::exists(entity)) {
+            ecs::destroy(entity);
+        }
+    }
+    std::printf("sparse components\n");
+
+    // Worlds own their components and clones share nothing with the original
+    ecs::World world_a;
+    ecs::World world_b;
+    const auto world_ent = world_a.create_entity();
+    world_a.add_component<Position>(world_ent, 1.0f, 2.0f);
+    world_a.add_component<Target>(world_ent, 7u);
+    assert(world_b.create_entity() == world_ent && !world_b.has_component<Position>(world_ent));
+    world_b.add_component<Position>(world_ent, 3.0f, 4.0f);
+    assert(world_a.get_component<Position>(world_ent).x == 1.0f);
+    usize num_world_a = 0;
+    world_a.for_each_entity<Position>([&](ecs::Entity) { num_world_a++; });
+    assert(num_world_a == 1);
+    auto world_c = world_a.clone();
+    world_c.get_component<Position>(world_ent).x = 5.0f;
+    world_c.get_component<Target>(world_ent).value = 8;
+    const auto clone_ent = world_c.create_entity();
+    world_c.add_component<Position>(clone_ent, 6.0f, 7.0f);
+    assert(world_a.get_component<Position>(world_ent).x == 1.0f);
+    assert(world_a.get_component<Target>(world_ent).value == 7 && !world_a.exists(clone_ent));
+    usize num_world_c = 0;
+    world_c.for_each_entity<Position>([&](ecs::Entity, Position& pos) {
+        assert(pos.x == 5.0f || pos.x == 6.0f);
+        num_world_c++;
+    });
+    assert(num_world_c == 2);
+    ecs::CommandBuffer world_cmd;
+    world_cmd.destroy(world_ent);
+    world_cmd.playback(world_c);
+    assert(!world_c.exists(world_ent) && world_a.exists(world_ent));
+    std::printf("multiple worlds\n");
+
+    // Filters only visit the components that were added or changed since their last run
+    std::vector<ecs::Entity> tracked;
+    for (usize i = 0; i < 4; ++i) {
+        tracked.push_back(ecs::create());
+        ecs::add<Health>(tracked.back(), 1.0f);
+    }
+    const auto visit = [](auto filter) {
+        std::vector<ecs::Entity> visited;
+        ecs::for_each<const Health>(
+            filter, [&](ecs::Entity entity, const Health&) { visited.push_back(entity); });
+        return visited;
+    };
+    ecs::Tick added_run = 0;
+    ecs::Tick changed_run = 0;
+    assert(visit(ecs::Added<Health>(added_run)) == tracked);
+    assert(visit(ecs::Changed<Health>(changed_run)) == tracked);
+    assert(visit(ecs::Added<Health>(added_run)).empty());
+    assert(visit(ecs::Changed<Health>(changed_run)).empty());
+    ecs::get<Health>(tracked[0]).value = 2.0f;
+    assert(ecs::get<const Health>(tracked[1]).value == 1.0f);
+    ecs::mark_changed<Health>(tracked[2]);
+    ecs::add<Position>(tracked[3], 0.0f, 0.0f);
+    assert(visit(ecs::Changed<Health>(changed_run)) == std::vector({ tracked[0], tracked[2] }));
+    ecs::for_each<Health>([](ecs::Entity, Health& health) { health.value += 1.0f; });
+    assert(visit(ecs::Changed<Health>(changed_run)) == tracked);
+    tracked.push_back(ecs::create());
+    ecs::add<Health>(tracked.back(), 1.0f);
+    assert(visit(ecs::Added<Health>(added_run)) == std::vector({ tracked.back() }));
+    for (const auto entity : tracked) {
+        ecs::destroy(entity);
+    }
+    std::printf("change detection\n");
+
+    // Restoring a snapshot brings back the same entities, components and ticks
+    ecs::World saved;
+    std::vector<ecs::Entity> saved_ents;
+    for (u32 i = 0; i < 300; ++i) {
+        saved_ents.push_back(saved.create_entity());
+        saved.add_component<Position>(saved_ents.back(), static_cast<float>(i), 0.0f);
+        if (i % 3 == 0) {
+            saved.add_component<Target>(saved_ents.back(), i);
+        }
+    }
+    for (u32 i = 0; i < 300; i += 7) {
+        saved.destroy_entity(saved_ents[i]);
+    }
+    const auto saved_tick = saved.tick();
+    const auto snapshot = saved.snapshot();
+    const auto compressed = saved.snapshot(true);
+    assert(compressed.size() < snapshot.size());
+    for (const auto& data : { snapshot, compressed }) {
+        ecs::World restored;
+        restored.add_component<Health>(restored.create_entity(), 1.0f);
+        assert(restored.restore(data) && restored.tick() == saved_tick);
+        for (u32 i = 0; i < 300; ++i) {
+            const auto entity = saved_ents[i];
+            assert(restored.exists(entity) == (i % 7 != 0));
+            if (restored.exists(entity)) {
+                assert(restored.get_component<const Position>(entity).x == static_cast<float>(i));
+                assert(restored.has_component<Target>(entity) == (i % 3 == 0));
+                assert(!restored.has_component<Health>(entity));
+            }
+        }
+        usize num_targets = 0;
+        restored.for_each_entity<const Target>([&](ecs::Entity entity, const Target& target) {
+            assert(target.value == entity.idx());
+            num_targets++;
+        });
+        assert(num_targets == 100 - 15);
+        // The lowest free index is reused with the next generation
+        assert(restored.create_entity() == saved_ents[0].next_generation());
+    }
+    // Both backends read and write the same format
+    ecs::PoolWorld pool_world;
+    ecs::ArchetypeWorld archetype_world;
+    assert(pool_world.restore(snapshot) && archetype_world.restore(pool_world.snapshot()));
+    assert(pool_world.restore(archetype_world.snapshot(true)));
+    assert(archetype_world.get_component<const Target>(saved_ents[3]).value == 3);
+    assert(pool_world.get_component<const Position>(saved_ents[299]).x == 299.0f);
+    // Rolling back invalidates the entities created since
+    const auto after_snapshot = saved.create_entity();
+    assert(saved.restore(snapshot) && !saved.exists(after_snapshot));
+    assert(!saved.restore(std::span(compressed).first(compressed.size() - 1)));
+    assert(!saved.exists(after_snapshot) && saved.exists(saved_ents[1]));
+    std::printf("snapshots\n");
+
+    // Instances of a prefab get copies of its components and consecutive indices, preferably from
+    // a run of free indices
+    ecs::Prefab prefab;
+    prefab.add<Position>(1.0f, 2.0f);
+    prefab.add<Target>(5u);
+    ecs::World prefab_world;
+    std::vector<ecs::Entity> prefab_ents;
+    for (usize i = 0; i < 10; ++i) {
+        prefab_ents.push_back(prefab_world.create_entity());
+    }
+    for (usize i = 3; i < 8; ++i) {
+        prefab_world.destroy_entity(prefab_ents[i]);
+    }
+    const auto in_hole = prefab_world.instantiate(prefab, 4);
+    const auto at_end = prefab_world.instantiate(prefab, 300);
+    assert(in_hole.size() == 4 && in_hole[0].idx() == 3 && in_hole[3].idx() == 6);
+    assert(at_end.size() == 300 && at_end[0].idx() == 10 && at_end[299].idx() == 309);
+    assert(prefab_world.create_entity().idx() == 7);
+    usize num_instances = 0;
+    prefab_world.for_each_entity<Position, const Target>(
+        [&](ecs::Entity, Position& pos, const Target& target) {
+            assert(pos.x == 1.0f && pos.y == 2.0f && target.value == 5);
+            pos.x = 3.0f;
+            num_instances++;
+        });
+    assert(num_instances == 304);
+    assert(prefab_world.get_component<const Position>(at_end[0]).x == 3.0f);
+    ecs::CommandBuffer prefab_cmd;
+    const auto burst_a = prefab_cmd.instantiate(prefab);
+    const auto created = prefab_cmd.create();
+    const auto burst_b = prefab_cmd.instantiate(prefab);
+    prefab_cmd.set<Position>(burst_a, 4.0f, 4.0f);
+    prefab_cmd.add<Position>(created, 6.0f, 6.0f);
+    prefab_cmd.set<Position>(burst_b, 5.0f, 5.0f);
+    prefab_cmd.destroy(in_hole[1]);
+    prefab_cmd.playback(prefab_world);
+    std::vector<float> burst_x;
+    prefab_world.for_each_entity<const Position>([&](ecs::Entity entity, const Position& pos) {
+        if (pos.x != 3.0f) {
+            assert(prefab_world.has_component<Target>(entity) == (pos.x != 6.0f));
+            burst_x.push_back(pos.x);
+        }
+    });
+    std::sort(burst_x.begin(), burst_x.end());
+    assert(burst_x == std::vector({ 4.0f, 5.0f, 6.0f }) && !prefab_world.exists(in_hole[1]));
+    std::printf("prefabs\n");
+
+    // The grid finds the same overlapping pairs as testing all of them, including circles outside
+    // of the space and on the cells at its edges
+    ecs::World spatial_world;
+    const ecs::Space space { 20.0f, 10.0f };
+    u32 seed = 1;
+    const auto rand_float = [&seed](float min, float max) {
+        seed = seed * 1664525u + 1013904223u;
+        return min + (max - min) * static_cast<float>(seed >> 8) / static_cast<float>(1 << 24);
+    };
+    for (usize i = 0; i < 500; ++i) {
+        const auto entity = spatial_world.create_entity();
+        spatial_world.add_component<Position>(
+            entity, rand_float(-12.0f, 12.0f), rand_float(-6.0f, 6.0f));
+        spatial_world.add_component<Health>(entity, rand_float(0.0f, 0.5f));
+    }
+    const auto circle = [](ecs::Entity, const Position& pos, const Health& health) {
+        return ecs::Circle { pos.x, pos.y, health.value };
+    };
+    std::vector<std::pair<u32, u32>> all_pairs, grid_pairs;
+    const auto add_pair = [](auto& pairs, ecs::Entity a, ecs::Entity b) {
+        pairs.emplace_back(std::min(a.idx(), b.idx()), std::max(a.idx(), b.idx()));
+    };
+    spatial_world.for_each_entity_pair<Position, Health>([&](ecs::Entity a, ecs::Entity b) {
+        const auto ca = circle(a, spatial_world.get_component<const Position>(a),
+            spatial_world.get_component<const Health>(a));
+        const auto cb = circle(b, spatial_world.get_component<const Position>(b),
+            spatial_world.get_component<const Health>(b));
+        const auto radius = ca.radius + cb.radius;
+        if ((ca.x - cb.x) * (ca.x - cb.x) + (ca.y - cb.y) * (ca.y - cb.y) < radius * radius) {
+            add_pair(all_pairs, a, b);
+        }
+    });
+    spatial_world.for_each_entity_pair<Position, const Health>(
+        space, circle, [&](ecs::Entity a, ecs::Entity b) { add_pair(grid_pairs, a, b); });
+    std::sort(all_pairs.begin(), all_pairs.end());
+    std::sort(grid_pairs.begin(), grid_pairs.end());
+    assert(!all_pairs.empty() && grid_pairs == all_pairs);
+    // Pairs with entities that are destroyed by func are skipped
+    usize num_pairs = 0;
+    spatial_world.for_each_entity_pair<Position, Health>(
+        space, circle, [&](ecs::Entity a, ecs::Entity b) {
+            assert(spatial_world.exists(a) && spatial_world.exists(b));
+            spatial_world.destroy_entity(b);
+            num_pairs++;
+        });
+    assert(num_pairs > 0 && num_pairs < all_pairs.size());
+    // The circles are taken before the first call to func, so func has to test the overlap again
+    // if it moves entities. Here three circles overlap and the first pair is moved apart, so the
+    // other two pairs are still reported, but don't overlap anymore.
+    ecs::World moving_world;
+    for (const auto x : { 0.0f, 0.6f, 0.975f }) {
+        const auto entity = moving_world.create_entity();
+        moving_world.add_component<Position>(entity, x, 0.0f);
+        moving_world.add_component<Health>(entity, 0.5f);
+    }
+    usize num_overlapping = 0, num_stale = 0;
+    moving_world.for_each_entity_pair<Position, Health>(
+        space, circle, [&](ecs::Entity a, ecs::Entity b) {
+            auto& a_pos = moving_world.get_component<Position>(a);
+            auto& b_pos = moving_world.get_component<Position>(b);
+            if (std::abs(b_pos.x - a_pos.x) >= 1.0f) {
+                num_stale++;
+                return;
+            }
+            a_pos.x -= 10.0f;
+            b_pos.x += 10.0f;
+            num_overlapping++;
+        });
+    assert(num_overlapping == 1 && num_stale == 2);
+    std::printf("spatial pairs\n");
+}
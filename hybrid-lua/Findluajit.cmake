@@ -47,7 +47,7 @@ endif()
 
 # We need to use this IMPORTED library with IMPORTED_LOCATION, so CMake will not complain
 # during configure, that the library does not exist.
-add_library(luajit STATIC IMPORTED)
+add_library(luajit STATIC IMPORTED GLOBAL)
 add_dependencies(luajit luajit_ep)
 set_target_properties(luajit PROPERTIES
     INTERFACE_INCLUDE_DIRECTORIES ${LUAJIT_INSTALL_INCLUDE_DIR}
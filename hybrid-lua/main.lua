@@ -160,20 +160,16 @@ local function create_ship()
     ship.last_shoot = false
 
     function ship:update(dt)
-        local accel = engine.get_scancode_down(26) -- W
+        local accel, turn, shoot = engine.get_input()
         if accel then
             local fx, fy, fz = engine.transform_get_forward(ship.transform)
             ship.velocity.x = ship.velocity.x - fx * dt * 2.0
             ship.velocity.z = ship.velocity.z - fz * dt * 2.0
         end
 
-        local left = engine.get_scancode_down(4) and 1 or 0 -- A
-        local right = engine.get_scancode_down(7) and 1 or 0 -- D
-        local turn = left - right
         local turn_angle = turn * math.pi * 2.0 * dt * 0.5
         engine.transform_rotate(ship.transform, 0, math.sin(turn_angle * 0.5), 0, math.cos(turn_angle * 0.5))
 
-        local shoot = engine.get_scancode_down(44)  -- space
         local shoot_pressed = shoot and not self.last_shoot
         self.last_shoot = shoot
         
@@ -266,30 +262,40 @@ local function draw_entities(entities)
     end
 end
 
-ship = create_ship()
+function init(num_asteroids)
+    ship = create_ship()
 
-for i = 1, 12 do
-    asteroids[i] = spawn_asteroid()
+    for i = 1, num_asteroids do
+        asteroids[i] = spawn_asteroid()
+    end
 end
 
 function update(dt)
+    engine.zone_begin("update_entities")
     ship:update(dt)
     update_entities(asteroids, dt)
     update_entities(bullets, dt)
+    engine.zone_end()
     
+    engine.zone_begin("sys_physics")
     sys_physics({ship}, dt)
     sys_physics(asteroids, dt)
     sys_physics(bullets, dt)
+    engine.zone_end()
     
+    engine.zone_begin("sys_collision")
     sys_collision(asteroids)
     sys_collision(bullets)
+    engine.zone_end()
     
+    engine.zone_begin("destroy_marked_entities")
     destroy_marked_entities(asteroids)
     destroy_marked_entities(bullets)
+    engine.zone_end()
+end
 
-    engine.begin_frame()
+function draw()
     draw_entities({ship})
     draw_entities(asteroids)
     draw_entities(bullets)
-    engine.end_frame()
 end
\ No newline at end of file
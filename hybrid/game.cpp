@@ -0,0 +1,425 @@
+#include <vector>
+
+#include <glm/gtx/transform.hpp>
+
+#include <glw/fmt.hpp>
+#include <glwx/transform.hpp>
+
+#include "../classic-ecs/ecs.hpp"
+#include "shared.hpp"
+
+namespace {
+struct Ship;
+struct Asteroid;
+struct Bullet;
+
+struct ShipTag { };
+struct AsteroidTag { };
+struct BulletTag { };
+
+struct Velocity {
+    glm::vec3 value = glm::vec3(0.0f);
+};
+
+struct Collider {
+    float radius;
+};
+
+struct Mesh {
+    MeshHandle mesh;
+    TextureHandle texture;
+};
+
+struct Entity;
+
+// The entity systems below use the components, so they need their ids first
+using Components = ecs::ComponentList<glwx::Transform, Velocity, Collider, Mesh, TransformHistory,
+    Entity*, ShipTag, AsteroidTag, BulletTag>;
+}
+
+ECS_COMPONENT_LIST(Components);
+
+namespace {
+struct Entity {
+    ecs::Entity id;
+    bool flushed = false;
+    bool destroyed = false;
+
+    Entity()
+        : id(ecs::create())
+    {
+        ecs::add<glwx::Transform>(id);
+        ecs::add<Velocity>(id);
+        ecs::add<Collider>(id);
+        ecs::add<Mesh>(id);
+        ecs::add<TransformHistory>(id);
+        ecs::add<Entity*>(id, this);
+    }
+
+    Entity(Entity&& other)
+        : id(std::exchange(other.id, ecs::Entity {}))
+        , flushed(other.flushed)
+        , destroyed(other.destroyed)
+    {
+        ecs::get<Entity*>(id) = this;
+    }
+
+    Entity& operator=(Entity&& other)
+    {
+        if (id) {
+            ecs::destroy(id);
+        }
+        id = std::exchange(other.id, ecs::Entity {});
+        flushed = other.flushed;
+        destroyed = other.destroyed;
+        ecs::get<Entity*>(id) = this;
+        return *this;
+    }
+
+    ~Entity()
+    {
+        if (id) {
+            ecs::destroy(id);
+        }
+    }
+
+    // The components are not cached, because the archetype storage moves them whenever the
+    // components of an entity change
+    glwx::Transform& transform() const { return ecs::get<glwx::Transform>(id); }
+    glm::vec3& velocity() const { return ecs::get<Velocity>(id).value; }
+    Collider& collider() const { return ecs::get<Collider>(id); }
+    Mesh& mesh() const { return ecs::get<Mesh>(id); }
+
+    virtual void on_collision(ecs::Entity) {};
+
+    void destroy() { destroyed = true; }
+    bool alive() const { return flushed && !destroyed; }
+};
+
+template <typename T>
+std::vector<T>& get_entities()
+{
+    static std::vector<T> entities;
+    return entities;
+}
+
+template <typename T>
+std::vector<T>& new_entities()
+{
+    static std::vector<T> entities;
+    return entities;
+}
+
+template <typename T>
+void flush_entities()
+{
+    auto& entities = get_entities<T>();
+    for (auto it = entities.begin(); it != entities.end();) {
+        if (it->destroyed) {
+            it = entities.erase(it);
+        } else {
+            it->flushed = true;
+            ++it;
+        }
+    }
+    for (auto& e : new_entities<T>()) {
+        entities.push_back(std::move(e));
+    }
+    new_entities<T>().clear();
+}
+
+struct Bullet final : public Entity {
+    float lifetime = 1.0f;
+
+    Bullet(const glwx::Transform& ship_trafo)
+    {
+        auto& trafo = transform();
+        trafo = ship_trafo;
+        trafo.setScale(1.0f);
+        trafo.move(-trafo.getForward() * 0.5f); // move bullet slightly in front of the ship
+        velocity() = -trafo.getForward() * 20.0f;
+        mesh().mesh = get_bullet_mesh();
+        mesh().texture = get_bullet_texture();
+        collider().radius = 1.0f;
+        ecs::add<BulletTag>(id);
+    }
+
+    void update(float dt)
+    {
+        lifetime -= dt;
+        if (lifetime <= 0.0f) {
+            destroy();
+        }
+    }
+
+    void on_collision(Asteroid&) { destroy(); }
+
+    void on_collision(ecs::Entity other)
+    {
+        if (ecs::has<AsteroidTag>(other)) {
+            // reinterpret_cast because Asteroid is incomplete here
+            on_collision(*reinterpret_cast<Asteroid*>(ecs::get<Entity*>(other)));
+        }
+    }
+};
+
+struct Ship final : public Entity {
+    BinaryInput shoot;
+
+    Ship()
+    {
+        transform().setScale(0.1f);
+        mesh().mesh = get_ship_mesh();
+        mesh().texture = get_ship_texture();
+        ecs::remove<Collider>(id);
+        ecs::add<ShipTag>(id);
+    }
+
+    void update(float dt)
+    {
+        // control
+        const auto input = get_player_input();
+
+        // control
+        auto& trafo = transform();
+        if (input.accel) {
+            velocity() += -trafo.getForward() * dt * 2.0f;
+        }
+
+        const auto turn = input.turn();
+        const auto quat = glm::angleAxis(
+            turn * glm::pi<float>() * 2.0f * dt, glm::vec3(0.0f, 1.0f, 0.0f) * 0.5f);
+        trafo.setOrientation(quat * trafo.getOrientation());
+
+        shoot.update(input.shoot);
+        if (shoot.pressed()) {
+            new_entities<Bullet>().push_back(Bullet(trafo));
+        }
+    }
+};
+
+struct Asteroid final : public Entity {
+    Asteroid(const glm::vec3& position, const glm::vec3& velocity, float size)
+    {
+        init(position, velocity, size);
+    }
+
+    Asteroid() { init(); }
+
+    void init(const glm::vec3& pos, const glm::vec3& vel, float size)
+    {
+        collider().radius = size * 0.5f * 0.85f; // fudge factor for collider
+        velocity() = vel;
+
+        auto& trafo = transform();
+        trafo.setPosition(pos);
+        trafo.setScale(size);
+        std::array<float, 4> quat;
+        randf(quat, -1.0f, 1.0f);
+        const auto orientation = glm::quat(quat[0], quat[1], quat[2], quat[3]);
+        trafo.setOrientation(glm::normalize(orientation));
+
+        const auto meshes = get_asteroid_meshes();
+        const auto mesh_idx = randi(0, meshes.size() - 1);
+        mesh().mesh = meshes[mesh_idx];
+        mesh().texture = get_asteroid_texture();
+
+        ecs::add<AsteroidTag>(id);
+    }
+
+    void init()
+    {
+        const auto edge = (randi(0, 1) * 2 - 1) * 0.4f * view_bounds_size;
+        const auto axis_pos = randf(-0.5f, 0.5f) * view_bounds_size;
+        const auto pos
+            = randb() ? glm::vec3(axis_pos.x, 0.0f, edge.y) : glm::vec3(edge.x, 0.0f, axis_pos.y);
+
+        const auto angle = randf(0.0f, glm::pi<float>() * 2.0f);
+        const auto speed = randf(1.0f, 3.0f);
+        const auto vel = glm::vec3(glm::cos(angle), 0.0f, glm::sin(angle)) * speed;
+
+        const auto size = randf(1.0f, 5.0f);
+
+        init(pos, vel, size);
+    }
+
+    void update(float) { }
+
+    void on_collision(Asteroid& other)
+    {
+        // Bit hacky, but we only want to execute this once
+        if (this < &other) {
+            collide_spheres(transform(), velocity(), collider().radius, other.transform(),
+                other.velocity(), other.collider().radius);
+        }
+    }
+
+    void on_collision(Bullet& b)
+    {
+        if (collider().radius > 0.5f) {
+            const auto& b_velocity = b.velocity();
+            const auto ortho = glm::normalize(glm::vec3(-b_velocity.z, 0.0f, b_velocity.x));
+            // 1/(2^(1/3)) times the origional radius should yield half the volume.
+            const auto radius = collider().radius * 0.8f;
+            for (size_t i = 0; i < 2; ++i) {
+                const auto dir = static_cast<float>(i) * 2.0f - 1.0f;
+                const auto pos = transform().getPosition() + dir * ortho * radius;
+                const auto vel = (velocity() + dir * ortho * glm::length(velocity()));
+                new_entities<Asteroid>().emplace_back(pos, vel, radius * 2.0f);
+            }
+        }
+        destroy();
+    }
+
+    void on_collision(ecs::Entity other)
+    {
+        if (ecs::has<AsteroidTag>(other)) {
+            on_collision(*static_cast<Asteroid*>(ecs::get<Entity*>(other)));
+        } else if (ecs::has<BulletTag>(other)) {
+            on_collision(*static_cast<Bullet*>(ecs::get<Entity*>(other)));
+        }
+    }
+};
+
+void sys_collision()
+{
+    SystemTimer timer("sys_collision");
+    ecs::for_each_pair<glwx::Transform, Collider>(
+        ecs::Space { view_bounds_size.x, view_bounds_size.y },
+        [](ecs::Entity, const glwx::Transform& transform, const Collider& collider) {
+            const auto pos = transform.getPosition();
+            return ecs::Circle { pos.x, pos.z, collider.radius };
+        },
+        [&](ecs::Entity a, ecs::Entity b) {
+            auto a_ent = ecs::get<Entity*>(a);
+            auto b_ent = ecs::get<Entity*>(b);
+            if (!a_ent->alive() || !b_ent->alive()) {
+                return;
+            }
+
+            // The circles are from before the first collision response, which might have moved
+            // them apart since
+            const auto rel = ecs::get<glwx::Transform>(b).getPosition()
+                - ecs::get<glwx::Transform>(a).getPosition();
+            const auto total_radius = ecs::get<Collider>(a).radius + ecs::get<Collider>(b).radius;
+            if (glm::dot(rel, rel) < total_radius * total_radius) {
+                a_ent->on_collision(b);
+                b_ent->on_collision(a);
+            }
+        });
+    flush_entities<Asteroid>();
+    flush_entities<Bullet>();
+}
+
+void sys_physics(float dt)
+{
+    SystemTimer timer("sys_physics");
+    ecs::for_each<glwx::Transform, Velocity>(
+        [dt](ecs::Entity, glwx::Transform& transform, Velocity& velocity) {
+            auto pos = transform.getPosition() + velocity.value * dt;
+
+            if (pos.x < -view_bounds_size.x * 0.5f) {
+                pos.x += view_bounds_size.x;
+            }
+            if (pos.x > view_bounds_size.x * 0.5f) {
+                pos.x -= view_bounds_size.x;
+            }
+            if (pos.z < -view_bounds_size.y * 0.5f) {
+                pos.z += view_bounds_size.y;
+            }
+            if (pos.z > view_bounds_size.y * 0.5f) {
+                pos.z -= view_bounds_size.y;
+            }
+            transform.setPosition(pos);
+        });
+}
+
+void sys_save_transforms()
+{
+    SystemTimer timer("sys_save_transforms");
+    ecs::for_each<glwx::Transform, TransformHistory>(
+        [](ecs::Entity, glwx::Transform& transform, TransformHistory& history) {
+            history.save(transform);
+        });
+}
+
+void sys_render(float alpha)
+{
+    SystemTimer timer("sys_render");
+    const auto shader = get_shader();
+    std::array<Uniform, 1> uniforms {
+        Uniform { uniform_location(get_shader(), "u_texture"), TextureHandle {} },
+    };
+    ecs::for_each<glwx::Transform, TransformHistory, Mesh>(
+        [&](ecs::Entity, glwx::Transform& transform, TransformHistory& history, Mesh& mesh) {
+            uniforms[0].value = mesh.texture;
+            draw(shader, mesh.mesh, history.interpolate(transform, alpha), uniforms);
+        });
+}
+
+void init_game(const GameConfig& config)
+{
+    get_entities<Ship>().emplace_back().flushed = true;
+
+    for (size_t i = 0; i < config.num_asteroids; ++i) {
+        get_entities<Asteroid>().emplace_back();
+    }
+}
+
+void update_game(float dt)
+{
+    sys_save_transforms();
+    {
+        SystemTimer timer("update_entities");
+        for (auto& e : get_entities<Ship>()) {
+            e.update(dt);
+        }
+        for (auto& e : get_entities<Asteroid>()) {
+            e.update(dt);
+        }
+        for (auto& e : get_entities<Bullet>()) {
+            e.update(dt);
+        }
+        flush_entities<Asteroid>();
+        flush_entities<Bullet>();
+    }
+    sys_physics(dt);
+    sys_collision();
+}
+
+void render_game(float alpha)
+{
+    sys_render(alpha);
+}
+
+void shutdown_game()
+{
+    get_entities<Ship>().clear();
+    get_entities<Asteroid>().clear();
+    get_entities<Bullet>().clear();
+    new_entities<Asteroid>().clear();
+    new_entities<Bullet>().clear();
+}
+}
+
+#ifdef ECS_ARCHETYPE_STORAGE
+namespace hybrid_archetype {
+#else
+namespace hybrid {
+#endif
+const Game& get_game()
+{
+    static const Game game {
+#ifdef ECS_ARCHETYPE_STORAGE
+        .name = "hybrid-archetype",
+#else
+        .name = "hybrid",
+#endif
+        .init = init_game,
+        .update = update_game,
+        .render = render_game,
+        .shutdown = shutdown_game,
+    };
+    return game;
+}
+}
@@ -0,0 +1,313 @@
+#include <vector>
+
+#include <glm/gtx/transform.hpp>
+
+#include <glw/fmt.hpp>
+#include <glwx/transform.hpp>
+
+#include "shared.hpp"
+
+namespace {
+struct Entity {
+    glwx::Transform transform;
+    TransformHistory transform_history;
+    glm::vec3 velocity = glm::vec3(0.0f);
+    float radius;
+    MeshHandle mesh;
+    TextureHandle texture;
+    bool marked_for_delection = false;
+
+    void destroy() { marked_for_delection = true; }
+
+    void draw(float alpha) const
+    {
+        static const auto shader = get_shader();
+        static std::array<Uniform, 1> uniforms {
+            Uniform { uniform_location(get_shader(), "u_texture"), TextureHandle {} },
+        };
+
+        uniforms[0].value = texture;
+        ::draw(shader, mesh, transform_history.interpolate(transform, alpha), uniforms);
+    }
+
+    void integrate(float dt)
+    {
+        auto pos = transform.getPosition() + velocity * dt;
+
+        if (pos.x < -view_bounds_size.x * 0.5f) {
+            pos.x += view_bounds_size.x;
+        }
+        if (pos.x > view_bounds_size.x * 0.5f) {
+            pos.x -= view_bounds_size.x;
+        }
+        if (pos.z < -view_bounds_size.y * 0.5f) {
+            pos.z += view_bounds_size.y;
+        }
+        if (pos.z > view_bounds_size.y * 0.5f) {
+            pos.z -= view_bounds_size.y;
+        }
+        transform.setPosition(pos);
+    }
+};
+
+template <typename T>
+std::vector<T>& get_entities()
+{
+    static std::vector<T> entities;
+    return entities;
+}
+
+template <typename T>
+std::vector<T>& new_entities()
+{
+    static std::vector<T> entities;
+    return entities;
+}
+
+template <typename T>
+void flush_new_entities()
+{
+    for (auto& e : new_entities<T>()) {
+        get_entities<T>().push_back(std::move(e));
+    }
+    new_entities<T>().clear();
+}
+
+template <typename T>
+void destroy_marked_for_deletion()
+{
+    auto& entities = get_entities<T>();
+    for (auto it = entities.begin(); it != entities.end();) {
+        if (it->marked_for_delection) {
+            it = entities.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+struct Bullet final : public Entity {
+    float lifetime = 1.0f;
+
+    Bullet(const glwx::Transform& ship_trafo)
+    {
+        transform = ship_trafo;
+        transform.setScale(1.0f);
+        transform.move(-transform.getForward() * 0.5f); // move bullet slightly in front of the ship
+        velocity = -transform.getForward() * 20.0f;
+        mesh = get_bullet_mesh();
+        texture = get_bullet_texture();
+        radius = 1.0f;
+    }
+
+    void update(float dt)
+    {
+        lifetime -= dt;
+        if (lifetime <= 0.0f) {
+            destroy();
+        }
+        integrate(dt);
+    }
+};
+
+struct Ship final : public Entity {
+    BinaryInput shoot;
+
+    Ship()
+    {
+        transform.setScale(0.1f);
+        mesh = get_ship_mesh();
+        texture = get_ship_texture();
+        radius = 1.0f;
+    }
+
+    void update(float dt)
+    {
+        // control
+        const auto input = get_player_input();
+
+        // control
+        if (input.accel) {
+            velocity += -transform.getForward() * dt * 2.0f;
+        }
+
+        const auto turn = input.turn();
+        const auto quat = glm::angleAxis(
+            turn * glm::pi<float>() * 2.0f * dt, glm::vec3(0.0f, 1.0f, 0.0f) * 0.5f);
+        transform.setOrientation(quat * transform.getOrientation());
+
+        shoot.update(input.shoot);
+        if (shoot.pressed()) {
+            get_entities<Bullet>().push_back(Bullet(transform));
+        }
+
+        integrate(dt);
+    }
+};
+
+struct Asteroid final : public Entity {
+    Asteroid(const glm::vec3& position, const glm::vec3& velocity, float size)
+    {
+        init(position, velocity, size);
+    }
+
+    Asteroid() { init(); }
+
+    void init(const glm::vec3& pos, const glm::vec3& vel, float size)
+    {
+        radius = size * 0.5f * 0.85f; // fudge factor for collider
+
+        transform.setPosition(pos);
+        transform.setScale(size);
+        std::array<float, 4> quat;
+        randf(quat, -1.0f, 1.0f);
+        const auto orientation = glm::quat(quat[0], quat[1], quat[2], quat[3]);
+        transform.setOrientation(glm::normalize(orientation));
+
+        const auto meshes = get_asteroid_meshes();
+        const auto mesh_idx = randi(0, meshes.size() - 1);
+        mesh = meshes[mesh_idx];
+        texture = get_asteroid_texture();
+
+        velocity = vel;
+    }
+
+    void init()
+    {
+        const auto edge = (randi(0, 1) * 2 - 1) * 0.4f * view_bounds_size;
+        const auto axis_pos = randf(-0.5f, 0.5f) * view_bounds_size;
+        const auto pos
+            = randb() ? glm::vec3(axis_pos.x, 0.0f, edge.y) : glm::vec3(edge.x, 0.0f, axis_pos.y);
+
+        const auto angle = randf(0.0f, glm::pi<float>() * 2.0f);
+        const auto speed = randf(1.0f, 3.0f);
+        const auto vel = glm::vec3(glm::cos(angle), 0.0f, glm::sin(angle)) * speed;
+
+        const auto size = randf(1.0f, 5.0f);
+
+        init(pos, vel, size);
+    }
+
+    void update(float dt) { integrate(dt); }
+};
+
+void collide_asteroid_bullet()
+{
+    SystemTimer timer("collide_asteroid_bullet");
+    for (auto& a : get_entities<Asteroid>()) {
+        for (auto& b : get_entities<Bullet>()) {
+            const auto rel = a.transform.getPosition() - b.transform.getPosition();
+            const auto total_radius = a.radius + b.radius;
+            if (glm::dot(rel, rel) < total_radius * total_radius) {
+                a.destroy();
+                b.destroy();
+
+                if (a.radius < 0.5f) {
+                    break;
+                }
+
+                const auto ortho = glm::normalize(glm::vec3(-b.velocity.z, 0.0f, b.velocity.x));
+                // 1/(2^(1/3)) times the origional radius should yield half the volume.
+                const auto radius = a.radius * 0.8f;
+                for (size_t i = 0; i < 2; ++i) {
+                    const auto dir = static_cast<float>(i) * 2.0f - 1.0f;
+                    const auto pos = a.transform.getPosition() + dir * ortho * radius;
+                    const auto vel = (a.velocity + dir * ortho * glm::length(a.velocity));
+                    new_entities<Asteroid>().emplace_back(pos, vel, radius * 2.0f);
+                }
+
+                break;
+            }
+        }
+    }
+    destroy_marked_for_deletion<Asteroid>();
+    destroy_marked_for_deletion<Bullet>();
+    flush_new_entities<Asteroid>();
+}
+
+void collide_asteroid_asteroid()
+{
+    SystemTimer timer("collide_asteroid_asteroid");
+    auto& asteroids = get_entities<Asteroid>();
+    for (auto a_it = asteroids.begin(); a_it != asteroids.end(); ++a_it) {
+        auto& a = *a_it;
+        for (auto b_it = a_it + 1; b_it != asteroids.end(); ++b_it) {
+            auto& b = *b_it;
+            const auto rel = a.transform.getPosition() - b.transform.getPosition();
+            const auto total_radius = a.radius + b.radius;
+            if (glm::dot(rel, rel) < total_radius * total_radius) {
+                collide_spheres(
+                    a.transform, a.velocity, a.radius, b.transform, b.velocity, b.radius);
+            }
+        }
+    }
+}
+
+void init_game(const GameConfig& config)
+{
+    get_entities<Ship>().emplace_back();
+
+    for (size_t i = 0; i < config.num_asteroids; ++i) {
+        get_entities<Asteroid>().emplace_back();
+    }
+}
+
+void update_game(float dt)
+{
+    {
+        SystemTimer timer("update_entities");
+        for (auto& e : get_entities<Ship>()) {
+            e.transform_history.save(e.transform);
+            e.update(dt);
+        }
+        for (auto& e : get_entities<Asteroid>()) {
+            e.transform_history.save(e.transform);
+            e.update(dt);
+        }
+        for (auto& e : get_entities<Bullet>()) {
+            e.transform_history.save(e.transform);
+            e.update(dt);
+        }
+        destroy_marked_for_deletion<Bullet>();
+    }
+
+    collide_asteroid_asteroid();
+    collide_asteroid_bullet();
+}
+
+void render_game(float alpha)
+{
+    SystemTimer timer("draw_entities");
+    for (auto& e : get_entities<Ship>()) {
+        e.draw(alpha);
+    }
+    for (auto& e : get_entities<Asteroid>()) {
+        e.draw(alpha);
+    }
+    for (auto& e : get_entities<Bullet>()) {
+        e.draw(alpha);
+    }
+}
+
+void shutdown_game()
+{
+    get_entities<Ship>().clear();
+    get_entities<Asteroid>().clear();
+    get_entities<Bullet>().clear();
+    new_entities<Asteroid>().clear();
+}
+}
+
+namespace no_polymorphism {
+const Game& get_game()
+{
+    static const Game game {
+        .name = "no-polymorphism",
+        .init = init_game,
+        .update = update_game,
+        .render = render_game,
+        .shutdown = shutdown_game,
+    };
+    return game;
+}
+}
@@ -0,0 +1,163 @@
+#include "lz.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace lz {
+namespace {
+constexpr usize MinMatch = 4;
+// As in LZ4, so its decoders can read our blocks: the last match starts at least 12 bytes before
+// the end and the last 5 bytes are always literals.
+constexpr usize MatchStartLimit = 12;
+constexpr usize LastLiterals = 5;
+constexpr usize MaxOffset = 65535;
+constexpr usize HashBits = 14;
+
+u32 read_u32(const std::byte* ptr)
+{
+    u32 value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+u64 read_u64(const std::byte* ptr)
+{
+    u64 value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+usize hash(u32 sequence)
+{
+    return (sequence * 2654435761u) >> (32 - HashBits);
+}
+
+// Lengths of 15 and more continue after the token in bytes of up to 255
+void write_length(std::vector<std::byte>& dst, usize length)
+{
+    for (length -= 15; length >= 255; length -= 255) {
+        dst.push_back(std::byte { 255 });
+    }
+    dst.push_back(static_cast<std::byte>(length));
+}
+
+bool read_length(std::span<const std::byte> src, usize& pos, usize& length)
+{
+    while (pos < src.size()) {
+        const auto byte = static_cast<u8>(src[pos++]);
+        length += byte;
+        if (byte != 255) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A match_length of 0 is the last sequence, which only has literals
+void write_sequence(std::vector<std::byte>& dst, const std::byte* literals, usize num_literals,
+    usize offset, usize match_length)
+{
+    const auto match_token = match_length > 0 ? match_length - MinMatch : 0;
+    dst.push_back(static_cast<std::byte>(
+        std::min<usize>(num_literals, 15) << 4 | std::min<usize>(match_token, 15)));
+    if (num_literals >= 15) {
+        write_length(dst, num_literals);
+    }
+    dst.insert(dst.end(), literals, literals + num_literals);
+    if (match_length > 0) {
+        dst.push_back(static_cast<std::byte>(offset & 0xff));
+        dst.push_back(static_cast<std::byte>(offset >> 8));
+        if (match_token >= 15) {
+            write_length(dst, match_token);
+        }
+    }
+}
+}
+
+void compress(std::span<const std::byte> src, std::vector<std::byte>& dst)
+{
+    const auto data = src.data();
+    const auto size = src.size();
+    usize anchor = 0; // The start of the literals that are not written yet
+    if (size > MatchStartLimit) {
+        // The last position of every hashed sequence. 0 is fine as the initial value, because
+        // candidates are compared before they are used.
+        const auto table = std::make_unique<u32[]>(usize(1) << HashBits);
+        const auto match_end = size - LastLiterals;
+        usize pos = 0;
+        while (pos < size - MatchStartLimit) {
+            const auto sequence = read_u32(data + pos);
+            auto& entry = table[hash(sequence)];
+            const usize candidate = entry;
+            entry = static_cast<u32>(pos);
+            if (candidate >= pos || pos - candidate > MaxOffset
+                || read_u32(data + candidate) != sequence) {
+                // Skip ahead faster the longer nothing matches, so incompressible data is cheap
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+
+            auto length = MinMatch;
+            while (pos + length + 8 <= match_end
+                && read_u64(data + candidate + length) == read_u64(data + pos + length)) {
+                length += 8;
+            }
+            while (pos + length < match_end && data[candidate + length] == data[pos + length]) {
+                length++;
+            }
+            write_sequence(dst, data + anchor, pos - anchor, pos - candidate, length);
+            pos += length;
+            anchor = pos;
+        }
+    }
+    write_sequence(dst, data + anchor, size - anchor, 0, 0);
+}
+
+bool decompress(std::span<const std::byte> src, std::span<std::byte> dst)
+{
+    usize in = 0;
+    usize out = 0;
+    while (in < src.size()) {
+        const auto token = static_cast<u8>(src[in++]);
+        usize num_literals = token >> 4;
+        if (num_literals == 15 && !read_length(src, in, num_literals)) {
+            return false;
+        }
+        if (num_literals > src.size() - in || num_literals > dst.size() - out) {
+            return false;
+        }
+        if (num_literals > 0) {
+            std::memcpy(dst.data() + out, src.data() + in, num_literals);
+        }
+        in += num_literals;
+        out += num_literals;
+        if (in == src.size()) {
+            break; // The last sequence has no match
+        }
+
+        if (src.size() - in < 2) {
+            return false;
+        }
+        const usize offset = static_cast<u8>(src[in]) | static_cast<u8>(src[in + 1]) << 8;
+        in += 2;
+        usize length = token & 15;
+        if (length == 15 && !read_length(src, in, length)) {
+            return false;
+        }
+        length += MinMatch;
+        if (offset == 0 || offset > out || length > dst.size() - out) {
+            return false;
+        }
+        // A match can overlap the bytes it writes (e.g. offset 1 repeats the last byte), so copy
+        // it in pieces that don't: every piece doubles the data that repeats with the offset.
+        for (usize copied = 0; copied < length;) {
+            const auto piece = std::min(length - copied, offset + copied);
+            std::memcpy(dst.data() + out + copied, dst.data() + out - offset, piece);
+            copied += piece;
+        }
+        out += length;
+    }
+    return out == dst.size();
+}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <cppasta/primitive_typedefs.hpp>
+
+// A small LZ77 compressor that writes the LZ4 block format (without the frame around it): runs of
+// literals and matches of at least 4 bytes up to 64 KB back, which are found with a hash table of
+// the last position of every 4-byte sequence. It only tries to be fast, not to compress well, which
+// is enough for data with lots of zeros and repeated values (e.g. world snapshots).
+namespace lz {
+// Appends the compressed data to dst
+void compress(std::span<const std::byte> src, std::vector<std::byte>& dst);
+
+// dst must have the size of the uncompressed data. Returns false if src is not valid compressed
+// data of that size.
+bool decompress(std::span<const std::byte> src, std::span<std::byte> dst);
+}
@@ -0,0 +1,146 @@
+#include "profiler.hpp"
+
+#ifdef GAC_PROFILER
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace prof {
+namespace {
+    struct Zone {
+        const char* name;
+        u64 start;
+        u64 end;
+    };
+
+    // 1.5 MB per thread, which is about a second of zones for the most fine-grained variants
+    constexpr usize ring_size = 1 << 16;
+
+    struct ThreadBuffer {
+        std::array<Zone, ring_size> zones;
+        u64 count = 0;
+        usize tid;
+        const char* name = nullptr;
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+        std::set<std::string, std::less<>> names;
+        // To convert ticks to nanoseconds we measure both at startup and when writing the trace
+        u64 start_ticks = now();
+        u64 start_ns = get_time_ns();
+    };
+
+    Registry& get_registry()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    // Create the registry during static initialization, so the calibration covers the whole run
+    [[maybe_unused]] const auto& registry_init = get_registry();
+
+    thread_local ThreadBuffer* thread_buffer = nullptr;
+
+    ThreadBuffer* get_thread_buffer()
+    {
+        if (!thread_buffer) {
+            auto& registry = get_registry();
+            std::lock_guard lock(registry.mutex);
+            auto& buffer = registry.buffers.emplace_back(std::make_unique<ThreadBuffer>());
+            buffer->tid = registry.buffers.size() - 1;
+            thread_buffer = buffer.get();
+        }
+        return thread_buffer;
+    }
+
+    std::string escape_json(std::string_view str)
+    {
+        std::string escaped;
+        escaped.reserve(str.size());
+        for (const auto c : str) {
+            if (c == '"' || c == '\\') {
+                escaped.push_back('\\');
+            }
+            escaped.push_back(c);
+        }
+        return escaped;
+    }
+}
+
+void record(const char* name, u64 start, u64 end)
+{
+    const auto buffer = get_thread_buffer();
+    buffer->zones[buffer->count % ring_size] = Zone { name, start, end };
+    buffer->count++;
+}
+
+const char* intern(std::string_view name)
+{
+    auto& registry = get_registry();
+    std::lock_guard lock(registry.mutex);
+    auto it = registry.names.find(name);
+    if (it == registry.names.end()) {
+        it = registry.names.emplace(name).first;
+    }
+    return it->c_str();
+}
+
+void set_thread_name(const char* name)
+{
+    get_thread_buffer()->name = name;
+}
+
+bool write_chrome_trace(const char* path)
+{
+    auto& registry = get_registry();
+    std::lock_guard lock(registry.mutex);
+
+    const auto ticks = now() - registry.start_ticks;
+    const auto ns = get_time_ns() - registry.start_ns;
+    const auto us_per_tick = ticks > 0 ? static_cast<double>(ns) / ticks / 1000.0 : 0.0;
+    const auto to_us = [&](u64 t) {
+        return static_cast<double>(static_cast<i64>(t - registry.start_ticks)) * us_per_tick;
+    };
+
+    auto file = std::fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+
+    fmt::print(file, "{{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    const char* sep = "\n";
+    for (const auto& buffer : registry.buffers) {
+        if (buffer->name) {
+            fmt::print(file,
+                "{}{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": {}, "
+                "\"args\": {{\"name\": \"{}\"}}}}",
+                sep, buffer->tid, escape_json(buffer->name));
+            sep = ",\n";
+        }
+
+        const auto num_zones = std::min<u64>(buffer->count, ring_size);
+        for (auto i = buffer->count - num_zones; i < buffer->count; ++i) {
+            const auto& zone = buffer->zones[i % ring_size];
+            fmt::print(file,
+                "{}{{\"name\": \"{}\", \"ph\": \"X\", \"pid\": 0, \"tid\": {}, \"ts\": {:.3f}, "
+                "\"dur\": {:.3f}}}",
+                sep, escape_json(zone.name), buffer->tid, to_us(zone.start),
+                static_cast<double>(zone.end - zone.start) * us_per_tick);
+            sep = ",\n";
+        }
+    }
+    fmt::print(file, "\n]}}\n");
+
+    return std::fclose(file) == 0;
+}
+}
+#endif
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string_view>
+
+#include <cppasta/primitive_typedefs.hpp>
+
+#if defined(GAC_PROFILER) && (defined(__x86_64__) || defined(_M_X64))
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// Declared in shared.hpp as well, which is too heavy to include here
+u64 get_time_ns();
+
+// A minimal zone profiler. Every thread records the zones it finishes into its own ring buffer (no
+// locking) and write_chrome_trace writes all of them in the Trace Event Format, which can be opened
+// in chrome://tracing or https://ui.perfetto.dev.
+// If GAC_PROFILER is not defined, all of this compiles to nothing.
+namespace prof {
+#ifdef GAC_PROFILER
+// On x86-64 this is the TSC (invariant on every CPU made in the last 15 years), otherwise
+// nanoseconds. Ticks are converted to nanoseconds when writing the trace.
+inline u64 now()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    return __rdtsc();
+#else
+    return ::get_time_ns();
+#endif
+}
+
+// Zones that do not fit into the ring buffer overwrite the oldest ones.
+// name has to outlive the profiler (use string literals or intern).
+void record(const char* name, u64 start, u64 end);
+
+// For names that are not string literals (e.g. from Lua). Returns the same pointer for equal names.
+const char* intern(std::string_view name);
+
+// Used as the thread's name in the trace
+void set_thread_name(const char* name);
+
+// Must not be called while other threads are recording zones. Returns false if the file could not
+// be written.
+bool write_chrome_trace(const char* path);
+
+class ScopedZone {
+public:
+    explicit ScopedZone(const char* name) : name_(name), start_(now()) { }
+    ~ScopedZone() { record(name_, start_, now()); }
+
+    ScopedZone(const ScopedZone&) = delete;
+    ScopedZone& operator=(const ScopedZone&) = delete;
+
+private:
+    const char* name_;
+    u64 start_;
+};
+#else
+inline u64 now()
+{
+    return 0;
+}
+
+inline void record(const char*, u64, u64) { }
+inline const char* intern(std::string_view)
+{
+    return "";
+}
+inline void set_thread_name(const char*) { }
+inline bool write_chrome_trace(const char*)
+{
+    return false;
+}
+
+class ScopedZone {
+public:
+    explicit ScopedZone(const char*) { }
+
+    ScopedZone(const ScopedZone&) = delete;
+    ScopedZone& operator=(const ScopedZone&) = delete;
+};
+#endif
+}
+
+#define GAC_PROFILE_CONCAT_IMPL(a, b) a##b
+#define GAC_PROFILE_CONCAT(a, b) GAC_PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_ZONE(name) prof::ScopedZone GAC_PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
@@ -1,12 +1,27 @@
 #include "shared.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
 #include <string>
 
 #include <fmt/core.h>
 
+#include <glm/gtc/quaternion.hpp>
+
 #include <glw/buffer.hpp>
+#include <glw/state.hpp>
 #include <glwx/shader.hpp>
 #include <glwx/texture.hpp>
+#include <glwx/window.hpp>
 
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
 #include "tiny_obj_loader.h"
@@ -35,10 +50,186 @@ auto& get_shader_storage()
     static SlotMap<glw::ShaderProgram, ShaderHandle> storage(64);
     return storage;
 }
+
+// The null backend keeps just enough about every asset to know it was loaded properly
+struct NullTexture {
+    u32 width;
+    u32 height;
+};
+
+struct NullMesh {
+    usize vertex_count;
+};
+
+struct NullShader {
+    usize source_size;
+};
+
+auto& get_null_texture_storage()
+{
+    static SlotMap<NullTexture, TextureHandle> storage(64);
+    return storage;
+}
+
+auto& get_null_mesh_storage()
+{
+    static SlotMap<NullMesh, MeshHandle> storage(64);
+    return storage;
+}
+
+auto& get_null_shader_storage()
+{
+    static SlotMap<NullShader, ShaderHandle> storage(64);
+    return storage;
+}
+
+struct State {
+    std::optional<RenderBackend> backend;
+    std::optional<PlayerInput> player_input;
+    std::optional<glwx::Window> window;
+    u64 max_frames = 0; // 0 means unlimited
+    RenderStats stats;
+    glm::mat4 projection_matrix;
+    glm::mat4 view_matrix;
+    glm::vec3 light_dir;
+};
+
+State& get_state()
+{
+    static State state;
+    return state;
+}
+
+std::optional<std::string> read_file(std::string_view path)
+{
+    std::ifstream file(std::string(path), std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+u32 read_u32_be(std::string_view data, usize offset)
+{
+    const auto b = reinterpret_cast<const u8*>(data.data() + offset);
+    return (u32(b[0]) << 24) | (u32(b[1]) << 16) | (u32(b[2]) << 8) | u32(b[3]);
+}
+
+TextureHandle load_null_texture(std::string_view path)
+{
+    // We only parse the PNG header, so we know the file is there and it is a PNG
+    const auto data = read_file(path);
+    constexpr std::string_view png_signature = "\x89PNG\r\n\x1a\n";
+    if (!data || data->size() < 24 || !data->starts_with(png_signature)) {
+        fmt::println(stderr, "Could not load texture from '{}'", path);
+        std::exit(1);
+    }
+    // IHDR is always the first chunk: length (4), type (4), width (4), height (4)
+    return get_null_texture_storage().insert(
+        NullTexture { read_u32_be(*data, 16), read_u32_be(*data, 20) });
+}
+
+ShaderHandle load_null_shader(std::string_view vert_path, std::string_view frag_path)
+{
+    const auto vert = read_file(vert_path);
+    const auto frag = read_file(frag_path);
+    if (!vert || !frag) {
+        fmt::println(stderr, "Could not load shader from '{}'/'{}'", vert_path, frag_path);
+        std::exit(1);
+    }
+    return get_null_shader_storage().insert(NullShader { vert->size() + frag->size() });
+}
+}
+
+void set_render_backend(RenderBackend backend)
+{
+    assert(!get_state().window);
+    get_state().backend = backend;
+}
+
+RenderBackend get_render_backend()
+{
+    auto& state = get_state();
+    if (!state.backend) {
+        state.backend = std::getenv("GAC_HEADLESS") ? RenderBackend::Null : RenderBackend::OpenGL;
+    }
+    return *state.backend;
+}
+
+const RenderStats& get_render_stats()
+{
+    return get_state().stats;
+}
+
+PlayerInput get_player_input()
+{
+    if (get_state().player_input) {
+        return *get_state().player_input;
+    }
+
+    static int num_keys = 0;
+    static const auto kb_state = SDL_GetKeyboardState(&num_keys);
+    return PlayerInput {
+        .accel = kb_state[SDL_SCANCODE_W] > 0,
+        .turn_left = kb_state[SDL_SCANCODE_A] > 0,
+        .turn_right = kb_state[SDL_SCANCODE_D] > 0,
+        .shoot = kb_state[SDL_SCANCODE_SPACE] > 0,
+    };
+}
+
+void set_player_input(const PlayerInput& input)
+{
+    get_state().player_input = input;
+}
+
+u64 get_time_ns()
+{
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+namespace {
+std::vector<SystemStats>& get_system_stats_storage()
+{
+    static std::vector<SystemStats> stats;
+    return stats;
+}
+
+// Systems might run on multiple threads (classic-ecs/scheduler.hpp)
+std::mutex system_stats_mutex;
+}
+
+SystemTimer::~SystemTimer()
+{
+    const auto duration = get_time_ns() - start_;
+    std::lock_guard lock(system_stats_mutex);
+    auto& stats = get_system_stats_storage();
+    for (auto& sys : stats) {
+        if (sys.name == name_ || std::strcmp(sys.name, name_) == 0) {
+            sys.total_ns += duration;
+            sys.calls++;
+            return;
+        }
+    }
+    stats.push_back(SystemStats { name_, duration, 1 });
+}
+
+std::span<const SystemStats> get_system_stats()
+{
+    return get_system_stats_storage();
+}
+
+void reset_system_stats()
+{
+    get_system_stats_storage().clear();
 }
 
 TextureHandle load_texture(std::string_view path)
 {
+    if (get_render_backend() == RenderBackend::Null) {
+        return load_null_texture(path);
+    }
+
     auto tex = glwx::makeTexture2D(std::filesystem::path(path));
     if (!tex) {
         fmt::println(stderr, "Could not load texture from '{}'", path);
@@ -47,7 +238,15 @@ TextureHandle load_texture(std::string_view path)
     return get_texture_storage().insert(std::move(tex.value()));
 }
 
-MeshHandle load_obj_mesh(std::string_view path, bool normalize)
+namespace {
+struct Vertex {
+    glm::vec3 position;
+    glm::vec3 normal = glm::vec3(0.0f);
+    glm::vec2 texcoord = glm::vec2(0.0f);
+    glm::vec3 color = glm::vec3(1.0f);
+};
+
+std::vector<Vertex> load_obj_vertices(std::string_view path, bool normalize)
 {
     tinyobj::ObjReaderConfig reader_config;
     reader_config.triangulate = true;
@@ -72,13 +271,6 @@ MeshHandle load_obj_mesh(std::string_view path, bool normalize)
         return n;
     }();
 
-    struct Vertex {
-        glm::vec3 position;
-        glm::vec3 normal = glm::vec3(0.0f);
-        glm::vec2 texcoord = glm::vec2(0.0f);
-        glm::vec3 color = glm::vec3(1.0f);
-    };
-
     std::vector<Vertex> vertex_data(vertex_count);
     usize vert_idx = 0;
 
@@ -132,6 +324,18 @@ MeshHandle load_obj_mesh(std::string_view path, bool normalize)
         }
     }
 
+    return vertex_data;
+}
+}
+
+MeshHandle load_obj_mesh(std::string_view path, bool normalize)
+{
+    const auto vertex_data = load_obj_vertices(path, normalize);
+
+    if (get_render_backend() == RenderBackend::Null) {
+        return get_null_mesh_storage().insert(NullMesh { vertex_data.size() });
+    }
+
     auto& buffers = get_buffer_storage();
     auto vertex_buffer = buffers.get(buffers.insert(glw::Buffer()));
     vertex_buffer->data(
@@ -152,6 +356,10 @@ MeshHandle load_obj_mesh(std::string_view path, bool normalize)
 
 ShaderHandle load_shader(std::string_view vert_path, std::string_view frag_path)
 {
+    if (get_render_backend() == RenderBackend::Null) {
+        return load_null_shader(vert_path, frag_path);
+    }
+
     auto prog = glwx::makeShaderProgram(
         std::filesystem::path(vert_path), std::filesystem::path(frag_path));
     if (!prog) {
@@ -163,6 +371,10 @@ ShaderHandle load_shader(std::string_view vert_path, std::string_view frag_path)
 
 glw::ShaderProgram::UniformLocation uniform_location(ShaderHandle handle, std::string_view name)
 {
+    if (get_render_backend() == RenderBackend::Null) {
+        assert(get_null_shader_storage().contains(handle));
+        return {};
+    }
     return get_shader_storage().get(handle)->getUniformLocation(std::string(name));
 }
 
@@ -214,19 +426,188 @@ TextureHandle get_bullet_texture()
     return texture;
 }
 
+namespace {
+u64 splitmix64(u64& x)
+{
+    x += 0x9e3779b97f4a7c15;
+    auto z = x;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+}
+
+void Rng::seed(u64 seed, u64 stream)
+{
+    // Recommended by the xoshiro authors. splitmix64 never produces an all-zero state.
+    auto x = seed ^ splitmix64(stream);
+    for (auto& s : state_) {
+        s = splitmix64(x);
+    }
+}
+
+int Rng::randi(int min, int max)
+{
+    assert(min <= max);
+    // Lemire's multiply-and-reject (https://arxiv.org/abs/1805.10941)
+    const auto range = static_cast<u32>(static_cast<i64>(max) - min) + 1;
+    if (range == 0) { // [INT_MIN, INT_MAX]
+        return static_cast<int>(static_cast<u32>(next() >> 32));
+    }
+    auto m = (next() >> 32) * range;
+    if (static_cast<u32>(m) < range) {
+        const auto threshold = static_cast<u32>(-range) % range;
+        while (static_cast<u32>(m) < threshold) {
+            m = (next() >> 32) * range;
+        }
+    }
+    return static_cast<int>(static_cast<i64>(min) + static_cast<i64>(m >> 32));
+}
+
+void Rng::randf(std::span<float> out, float min, float max)
+{
+    const auto scale = max - min;
+    usize i = 0;
+    for (; i + 1 < out.size(); i += 2) {
+        const auto bits = next();
+        out[i] = min + to_unit_float(bits >> 40) * scale;
+        out[i + 1] = min + to_unit_float(bits >> 8) * scale;
+    }
+    if (i < out.size()) {
+        out[i] = randf(min, max);
+    }
+}
+
+namespace {
+u64 get_rng_stream()
+{
+    static std::atomic<u64> next_stream { 0 };
+    thread_local const auto stream = next_stream++;
+    return stream;
+}
+}
+
+Rng& get_rng()
+{
+    thread_local Rng rng(Rng::default_seed, get_rng_stream());
+    return rng;
+}
+
+void seed_rng(u64 seed)
+{
+    // Keep the stream, so threads seeded with the same value still produce different sequences
+    get_rng().seed(seed, get_rng_stream());
+}
+
 int randi(int min, int max)
 {
-    return min + std::rand() % (max + 1 - min);
+    return get_rng().randi(min, max);
 }
 
 float randf(float min, float max)
 {
-    return min + std::rand() / static_cast<float>(RAND_MAX) * (max - min);
+    return get_rng().randf(min, max);
 }
 
 bool randb()
 {
-    return std::rand() % 2 == 0;
+    return get_rng().randb();
+}
+
+void randf(std::span<float> out, float min, float max)
+{
+    get_rng().randf(out, min, max);
+}
+
+namespace {
+constexpr std::string_view input_recording_magic = "GACI";
+constexpr u32 input_recording_version = 2;
+
+enum InputBits : u8 {
+    Accel = 1 << 0,
+    TurnLeft = 1 << 1,
+    TurnRight = 1 << 2,
+    Shoot = 1 << 3,
+};
+
+template <typename T>
+void write_le(std::string& data, T value)
+{
+    for (usize i = 0; i < sizeof(T); ++i) {
+        data.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+template <typename T>
+T read_le(std::string_view data, usize offset)
+{
+    T value = 0;
+    for (usize i = 0; i < sizeof(T); ++i) {
+        value |= static_cast<T>(static_cast<u8>(data[offset + i])) << (8 * i);
+    }
+    return value;
+}
+}
+
+bool save_input_recording(const InputRecording& recording, std::string_view path)
+{
+    std::string data(input_recording_magic);
+    write_le<u32>(data, input_recording_version);
+    write_le<u64>(data, recording.seed);
+    write_le<u32>(data, recording.num_asteroids);
+    write_le<u32>(data, std::bit_cast<u32>(recording.timestep.rate_hz));
+    write_le<u32>(data, recording.timestep.max_steps_per_frame);
+    write_le<u32>(data, static_cast<u32>(recording.frames.size()));
+    for (const auto& frame : recording.frames) {
+        u8 bits = 0;
+        bits |= frame.input.accel ? InputBits::Accel : 0;
+        bits |= frame.input.turn_left ? InputBits::TurnLeft : 0;
+        bits |= frame.input.turn_right ? InputBits::TurnRight : 0;
+        bits |= frame.input.shoot ? InputBits::Shoot : 0;
+        write_le<u8>(data, bits);
+        write_le<u32>(data, std::bit_cast<u32>(frame.dt));
+    }
+
+    std::ofstream file(std::string(path), std::ios::binary);
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(file);
+}
+
+std::optional<InputRecording> load_input_recording(std::string_view path)
+{
+    const auto data = read_file(path);
+    constexpr usize header_size = 32;
+    if (!data || data->size() < header_size || !data->starts_with(input_recording_magic)
+        || read_le<u32>(*data, 4) != input_recording_version) {
+        return std::nullopt;
+    }
+
+    InputRecording recording;
+    recording.seed = read_le<u64>(*data, 8);
+    recording.num_asteroids = read_le<u32>(*data, 16);
+    recording.timestep.rate_hz = std::bit_cast<float>(read_le<u32>(*data, 20));
+    recording.timestep.max_steps_per_frame = read_le<u32>(*data, 24);
+    const auto num_frames = read_le<u32>(*data, 28);
+    constexpr usize frame_size = 5;
+    if (data->size() != header_size + num_frames * frame_size) {
+        return std::nullopt;
+    }
+
+    recording.frames.resize(num_frames);
+    for (usize i = 0; i < num_frames; ++i) {
+        const auto offset = header_size + i * frame_size;
+        const auto bits = read_le<u8>(*data, offset);
+        recording.frames[i] = InputRecording::Frame {
+            .input = PlayerInput {
+                .accel = (bits & InputBits::Accel) != 0,
+                .turn_left = (bits & InputBits::TurnLeft) != 0,
+                .turn_right = (bits & InputBits::TurnRight) != 0,
+                .shoot = (bits & InputBits::Shoot) != 0,
+            },
+            .dt = std::bit_cast<float>(read_le<u32>(*data, offset + 1)),
+        };
+    }
+    return recording;
 }
 
 void collide_spheres(glwx::Transform& a_trafo, glm::vec3& a_vel, float a_rad,
@@ -252,24 +633,69 @@ void collide_spheres(glwx::Transform& a_trafo, glm::vec3& a_vel, float a_rad,
     b_vel -= c / (1.0f + b_mass / a_mass) * n_rel;
 }
 
-namespace {
-struct State {
-    glm::mat4 projection_matrix;
-    glm::mat4 view_matrix;
-    glm::vec3 light_dir;
-};
+u32 FixedTimestep::advance(float frame_dt)
+{
+    if (config_.rate_hz <= 0.0f) {
+        return 1;
+    }
 
-State& get_state()
+    const auto dt = step_dt(frame_dt);
+    accumulator_ += frame_dt;
+    u32 steps = 0;
+    while (accumulator_ >= dt && steps < config_.max_steps_per_frame) {
+        accumulator_ -= dt;
+        steps++;
+    }
+    // Drop the time we could not catch up on
+    accumulator_ = std::min(accumulator_, dt);
+    return steps;
+}
+
+float FixedTimestep::alpha() const
 {
-    static State state;
-    return state;
+    return config_.rate_hz > 0.0f ? accumulator_ * config_.rate_hz : 1.0f;
 }
+
+glwx::Transform TransformHistory::interpolate(const glwx::Transform& current, float alpha) const
+{
+    if (!previous_) {
+        return current;
+    }
+
+    const auto rel = current.getPosition() - previous_->getPosition();
+    if (std::abs(rel.x) > view_bounds_size.x * 0.5f
+        || std::abs(rel.z) > view_bounds_size.y * 0.5f) {
+        return current;
+    }
+
+    glwx::Transform trafo;
+    trafo.setPosition(glm::mix(previous_->getPosition(), current.getPosition(), alpha));
+    trafo.setOrientation(glm::slerp(previous_->getOrientation(), current.getOrientation(), alpha));
+    trafo.setScale(glm::mix(previous_->getScale(), current.getScale(), alpha));
+    return trafo;
 }
 
-void init(float aspect)
+void init(std::string_view window_title)
 {
     auto& state = get_state();
 
+    auto aspect = 16.0f / 9.0f;
+    if (get_render_backend() == RenderBackend::Null) {
+        if (const auto frames = std::getenv("GAC_HEADLESS")) {
+            state.max_frames = std::strtoull(frames, nullptr, 10);
+        }
+    } else {
+        auto window = glwx::makeWindow(std::string(window_title), 1920, 1080);
+        if (!window) {
+            fmt::println(stderr, "Could not create window");
+            std::exit(1);
+        }
+        state.window.emplace(std::move(window.value()));
+        const auto size = state.window->getSize();
+        glw::State::instance().setViewport(size.x, size.y);
+        aspect = static_cast<float>(size.x) / size.y;
+    }
+
     glwx::Transform camera_trafo;
     // Look down on XZ plane (up is +Z)
     camera_trafo.setPosition(glm::vec3(0.0f, 15.0f, 0.0f));
@@ -280,6 +706,10 @@ void init(float aspect)
     state.projection_matrix = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 100.0f);
     state.light_dir = glm::normalize(glm::vec3(0.0f, 1.0f, 1.0f));
 
+    if (get_render_backend() == RenderBackend::Null) {
+        return;
+    }
+
     glEnable(GL_DEPTH_TEST);
 
     glw::State::instance().setBlendEnabled(true);
@@ -289,8 +719,34 @@ void init(float aspect)
     glw::State::instance().setCullFaceEnabled(false);
 }
 
+bool process_events()
+{
+    auto& state = get_state();
+    if (!state.window) {
+        return state.max_frames == 0 || state.stats.frames < state.max_frames;
+    }
+
+    SDL_Event event;
+    while (SDL_PollEvent(&event) != 0) {
+        switch (event.type) {
+        case SDL_QUIT:
+            return false;
+        case SDL_KEYDOWN:
+            switch (event.key.keysym.sym) {
+            case SDLK_ESCAPE:
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 void begin_frame()
 {
+    if (get_render_backend() == RenderBackend::Null) {
+        return;
+    }
+
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
@@ -327,6 +783,14 @@ void draw(ShaderHandle shader, MeshHandle mesh, const glwx::Transform& trafo,
     std::span<const Uniform> uniforms)
 {
     auto& state = get_state();
+    state.stats.draw_calls++;
+    state.stats.uniforms += uniforms.size();
+
+    if (get_render_backend() == RenderBackend::Null) {
+        assert(get_null_shader_storage().contains(shader));
+        assert(get_null_mesh_storage().contains(mesh));
+        return;
+    }
 
     auto& prog = *get_shader_storage().get(shader);
     prog.bind();
@@ -345,4 +809,85 @@ void draw(ShaderHandle shader, MeshHandle mesh, const glwx::Transform& trafo,
     get_mesh_storage().get(mesh)->draw();
 }
 
-void end_frame() { }
\ No newline at end of file
+void end_frame()
+{
+    auto& state = get_state();
+    state.stats.frames++;
+    if (state.window) {
+        state.window->swap();
+    }
+}
+
+int run(const Game& game, std::string_view window_title, TimestepConfig timestep)
+{
+    prof::set_thread_name("main");
+    init(window_title);
+
+    if (const auto rate = std::getenv("GAC_TICK_RATE")) {
+        timestep.rate_hz = std::strtof(rate, nullptr);
+    }
+
+    const GameConfig config;
+    std::optional<InputRecording> replay;
+    if (const auto path = std::getenv("GAC_REPLAY")) {
+        replay = load_input_recording(path);
+        if (!replay) {
+            fmt::println(stderr, "Could not load input recording from '{}'", path);
+            std::exit(1);
+        }
+    }
+
+    const auto record_path = std::getenv("GAC_RECORD");
+    InputRecording recording;
+    recording.num_asteroids = replay ? replay->num_asteroids : config.num_asteroids;
+    recording.seed = replay ? replay->seed : Rng::default_seed;
+    recording.timestep = replay ? replay->timestep : timestep;
+
+    seed_rng(recording.seed);
+    game.init(GameConfig { .num_asteroids = recording.num_asteroids });
+
+    FixedTimestep fixed_timestep(recording.timestep);
+    float time = glwx::getTime();
+    usize frame = 0;
+    while (process_events()) {
+        PROFILE_ZONE("frame");
+        const auto now = glwx::getTime();
+        auto dt = now - time;
+        time = now;
+
+        if (replay) {
+            if (frame >= replay->frames.size()) {
+                break;
+            }
+            set_player_input(replay->frames[frame].input);
+            dt = replay->frames[frame].dt;
+        }
+        if (record_path) {
+            recording.frames.push_back(InputRecording::Frame { get_player_input(), dt });
+        }
+        frame++;
+
+        const auto steps = fixed_timestep.advance(dt);
+        for (u32 i = 0; i < steps; ++i) {
+            game.update(fixed_timestep.step_dt(dt));
+        }
+
+        begin_frame();
+        game.render(fixed_timestep.alpha());
+        end_frame();
+    }
+
+    game.shutdown();
+
+    if (record_path && !save_input_recording(recording, record_path)) {
+        fmt::println(stderr, "Could not save input recording to '{}'", record_path);
+    }
+
+    if (const auto path = std::getenv("GAC_TRACE")) {
+        if (!prof::write_chrome_trace(path)) {
+            fmt::println(stderr, "Could not write trace to '{}'", path);
+        }
+    }
+
+    return 0;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <optional>
 #include <span>
 #include <string_view>
 #include <variant>
@@ -12,6 +14,8 @@
 #include <glwx/primitive.hpp>
 #include <glwx/transform.hpp>
 
+#include "profiler.hpp"
+
 constexpr glm::vec2 view_bounds_size(28.0f, 17.0f);
 
 struct BinaryInput {
@@ -27,6 +31,20 @@ struct BinaryInput {
     bool pressed() const { return state && !last_state; }
 };
 
+struct PlayerInput {
+    bool accel = false;
+    bool turn_left = false;
+    bool turn_right = false;
+    bool shoot = false;
+
+    float turn() const { return static_cast<float>(turn_left) - static_cast<float>(turn_right); }
+};
+
+// Returns the keyboard state (W, A, D, Space), unless an input was set with set_player_input.
+PlayerInput get_player_input();
+// Overrides the keyboard, e.g. for scripted input in benchmarks
+void set_player_input(const PlayerInput& input);
+
 template <typename T, typename Key>
 using PagedStorage = pasta::PagedSlotMapStorage<T, Key, std::vector<uint16_t>, std::allocator>;
 
@@ -57,20 +75,209 @@ TextureHandle get_asteroid_texture();
 MeshHandle get_bullet_mesh();
 TextureHandle get_bullet_texture();
 
+u64 get_time_ns();
+
+struct SystemStats {
+    const char* name;
+    u64 total_ns = 0;
+    u64 calls = 0;
+};
+
+// Measures the time until it is destroyed and adds it to the stats for the system with that name.
+// It also records a profiler zone. The name has to outlive the stats (use string literals).
+class SystemTimer {
+public:
+    SystemTimer(const char* name) : zone_(name), name_(name), start_(get_time_ns()) { }
+    ~SystemTimer();
+
+    SystemTimer(const SystemTimer&) = delete;
+    SystemTimer& operator=(const SystemTimer&) = delete;
+
+private:
+    prof::ScopedZone zone_;
+    const char* name_;
+    u64 start_;
+};
+
+std::span<const SystemStats> get_system_stats();
+void reset_system_stats();
+
+// xoshiro256** (https://prng.di.unimi.it/). Small, fast and the same sequence on every platform and
+// standard library, so runs with the same seed are reproducible.
+class Rng {
+public:
+    static constexpr u64 default_seed = 0x9e3779b97f4a7c15;
+
+    explicit Rng(u64 seed = default_seed, u64 stream = 0) { this->seed(seed, stream); }
+
+    // Different streams with the same seed produce unrelated sequences (e.g. one per thread)
+    void seed(u64 seed, u64 stream = 0);
+
+    u64 next()
+    {
+        const auto result = rotl(state_[1] * 5, 7) * 9;
+        const auto t = state_[1] << 17;
+        state_[2] ^= state_[0];
+        state_[3] ^= state_[1];
+        state_[1] ^= state_[2];
+        state_[0] ^= state_[3];
+        state_[2] ^= t;
+        state_[3] = rotl(state_[3], 45);
+        return result;
+    }
+
+    // Uniform in [min, max] without modulo bias
+    int randi(int min, int max);
+    // Uniform in [min, max)
+    float randf(float min, float max) { return min + to_unit_float(next() >> 40) * (max - min); }
+    bool randb() { return (next() >> 63) != 0; }
+
+    // Same as calling randf for every element, but two floats are taken from every 64 bit value
+    void randf(std::span<float> out, float min, float max);
+
+private:
+    static u64 rotl(u64 x, int k) { return (x << k) | (x >> (64 - k)); }
+    // Takes the lowest 24 bits, which is all a float can represent in [0, 1)
+    static float to_unit_float(u64 bits)
+    {
+        return static_cast<float>(bits & 0xffffff) * 0x1.0p-24f;
+    }
+
+    std::array<u64, 4> state_;
+};
+
+// Every thread has its own generator, so no locking is required. The first thread to use it
+// (usually the main thread) gets stream 0, the next one stream 1 and so on.
+Rng& get_rng();
+// Seeds the generator of the calling thread
+void seed_rng(u64 seed);
+
+// These use get_rng()
 int randi(int min, int max);
 float randf(float min, float max);
 bool randb();
+// Use this instead of multiple calls to randf in a single expression (e.g. function arguments),
+// because the order they are evaluated in is unspecified and might differ between compilers.
+void randf(std::span<float> out, float min, float max);
+
+struct TimestepConfig {
+    // Simulation steps per second. If 0, the frame time is used as dt (variable timestep).
+    float rate_hz = 60.0f;
+    // If a frame takes longer than this many steps, the simulation slows down instead of trying to
+    // catch up, which would make the next frame take even longer.
+    u32 max_steps_per_frame = 5;
+};
+
+// Turns frame times into a number of fixed simulation steps
+class FixedTimestep {
+public:
+    explicit FixedTimestep(const TimestepConfig& config) : config_(config) { }
+
+    // Returns how many steps of step_dt(frame_dt) to simulate this frame
+    u32 advance(float frame_dt);
+    float step_dt(float frame_dt) const
+    {
+        return config_.rate_hz > 0.0f ? 1.0f / config_.rate_hz : frame_dt;
+    }
+    // How far the frame is between the last two steps
+    float alpha() const;
+
+private:
+    TimestepConfig config_;
+    float accumulator_ = 0.0f;
+};
+
+// The input and dt of every frame of a session. Replaying it with the same seed and number of
+// asteroids produces exactly the same simulation in every variant.
+struct InputRecording {
+    struct Frame {
+        PlayerInput input;
+        float dt;
+    };
+
+    u64 seed = Rng::default_seed;
+    u32 num_asteroids = 0;
+    TimestepConfig timestep;
+    std::vector<Frame> frames;
+};
+
+// The file is a small header followed by 5 bytes per frame (input bits and dt), little-endian
+bool save_input_recording(const InputRecording& recording, std::string_view path);
+std::optional<InputRecording> load_input_recording(std::string_view path);
 
 void collide_spheres(glwx::Transform& a_trafo, glm::vec3& a_vel, float a_rad,
     glwx::Transform& b_trafo, glm::vec3& b_vel, float b_rad);
 
+// Remembers a transform from the previous simulation step, so rendering can interpolate between the
+// last two steps with a fixed timestep. Call save before every step.
+class TransformHistory {
+public:
+    void save(const glwx::Transform& trafo) { previous_ = trafo; }
+
+    // Returns current if nothing was saved yet (created during the last step) or if the transform
+    // jumped (wrapped around the edge of the screen).
+    glwx::Transform interpolate(const glwx::Transform& current, float alpha) const;
+
+private:
+    std::optional<glwx::Transform> previous_;
+};
+
 struct Uniform {
     glw::ShaderProgram::UniformLocation loc;
     std::variant<TextureHandle> value;
 };
 
-void init(float aspect);
+enum class RenderBackend {
+    OpenGL,
+    // No window and no GL context. Assets are still loaded and parsed, but draw calls are only
+    // counted. This is used to measure the cost of the simulation alone (and on machines without a
+    // GPU).
+    Null,
+};
+
+// Must be called before init. If it is not called, the null backend is used if the environment
+// variable GAC_HEADLESS is set and the OpenGL backend otherwise.
+void set_render_backend(RenderBackend backend);
+RenderBackend get_render_backend();
+
+struct RenderStats {
+    u64 frames = 0;
+    u64 draw_calls = 0;
+    u64 uniforms = 0;
+};
+
+const RenderStats& get_render_stats();
+
+// Creates the window (OpenGL backend only) and has to be called before loading any assets
+void init(std::string_view window_title);
+// Returns false if the game should quit. With the null backend this happens after the number of
+// frames given in GAC_HEADLESS (if any).
+bool process_events();
 void begin_frame();
 void draw(ShaderHandle shader, MeshHandle mesh, const glwx::Transform& trafo,
     std::span<const Uniform> uniforms);
-void end_frame();
\ No newline at end of file
+void end_frame();
+
+struct GameConfig {
+    usize num_asteroids = 12;
+};
+
+// Every variant implements this, so that all of them can be driven by the same main loop (run) and
+// by the benchmark.
+struct Game {
+    const char* name;
+    void (*init)(const GameConfig& config);
+    void (*update)(float dt);
+    // alpha is how far the frame is between the previous simulation step and the current one
+    void (*render)(float alpha);
+    // Destroys everything that was created since init
+    void (*shutdown)();
+};
+
+// Environment variables:
+// GAC_TRACE: a Chrome trace of the profiler zones is written to this file on exit.
+// GAC_RECORD: the input and dt of every frame is recorded and saved to this file on exit.
+// GAC_REPLAY: replays a recording instead of reading the keyboard and the clock and exits when it
+// is over. Combine it with GAC_HEADLESS=0 to replay without a window.
+// GAC_TICK_RATE: overrides timestep.rate_hz.
+int run(const Game& game, std::string_view window_title, TimestepConfig timestep = {});
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "thread_pool.hpp"
+
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "profiler.hpp"
+
+namespace {
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local usize current_index = 0;
+
+usize get_default_num_threads()
+{
+    const auto env = std::getenv("GAC_THREADS");
+    usize num_threads = 0;
+    if (env && std::from_chars(env, env + std::strlen(env), num_threads).ec == std::errc()
+        && num_threads > 0) {
+        return num_threads;
+    }
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+}
+
+ThreadPool& ThreadPool::instance()
+{
+    static ThreadPool pool(get_default_num_threads());
+    return pool;
+}
+
+ThreadPool::ThreadPool(usize num_threads)
+{
+    for (usize i = 0; i < std::max<usize>(num_threads, 1); ++i) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(sleep_mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+usize ThreadPool::thread_index() const
+{
+    return current_pool == this ? current_index : 0;
+}
+
+void ThreadPool::submit(Counter& counter, Task task)
+{
+    std::call_once(started_, [this] { start_workers(); });
+    counter++;
+    auto& queue = *queues_[thread_index()];
+    {
+        std::lock_guard lock(queue.mutex);
+        queue.entries.push_back(Entry { std::move(task), &counter });
+    }
+    num_queued_++;
+    // Lock, so a worker can't miss the notification between checking num_queued_ and sleeping
+    {
+        std::lock_guard lock(sleep_mutex_);
+    }
+    wake_.notify_one();
+}
+
+void ThreadPool::wait(Counter& counter)
+{
+    const auto index = thread_index();
+    while (counter.load() > 0) {
+        if (!run_one(index)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void ThreadPool::start_workers()
+{
+    for (usize i = 1; i < queues_.size(); ++i) {
+        workers_.emplace_back([this, i] { work(i); });
+    }
+}
+
+void ThreadPool::work(usize index)
+{
+    current_pool = this;
+    current_index = index;
+    prof::set_thread_name(prof::intern("worker " + std::to_string(index)));
+    while (true) {
+        if (run_one(index)) {
+            continue;
+        }
+        std::unique_lock lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return stop_ || num_queued_.load() > 0; });
+        if (stop_) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::run_one(usize index)
+{
+    Entry entry;
+    bool found = false;
+    {
+        auto& queue = *queues_[index];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.entries.empty()) {
+            entry = std::move(queue.entries.back());
+            queue.entries.pop_back();
+            found = true;
+        }
+    }
+    for (usize i = 1; i < queues_.size() && !found; ++i) {
+        auto& queue = *queues_[(index + i) % queues_.size()];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.entries.empty()) {
+            entry = std::move(queue.entries.front());
+            queue.entries.pop_front();
+            found = true;
+        }
+    }
+    if (!found) {
+        return false;
+    }
+
+    num_queued_--;
+    entry.task();
+    (*entry.counter)--;
+    return true;
+}
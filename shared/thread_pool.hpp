@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cppasta/primitive_typedefs.hpp>
+
+// A work-stealing thread pool. Every thread has its own task queue: it takes tasks from the back
+// of its own queue and steals from the front of the others once it is empty. Threads that wait for
+// tasks run tasks in the meantime, so tasks can submit tasks and wait for them too (e.g. a system
+// running on the pool that uses ecs::parallel_for_each).
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    // The number of unfinished tasks that were submitted with it
+    using Counter = std::atomic<usize>;
+
+    // Uses GAC_THREADS threads (if set) or one per core
+    static ThreadPool& instance();
+
+    // num_threads includes the thread that waits, so with 1 all tasks run inside wait.
+    // The worker threads are only started when the first task is submitted.
+    explicit ThreadPool(usize num_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    usize num_threads() const { return queues_.size(); }
+
+    // In [0, num_threads). The workers have 1 and up, every other thread has 0, so only one thread
+    // that is not a worker should use the pool at a time, if this is used to index per-thread data.
+    usize thread_index() const;
+
+    void submit(Counter& counter, Task task);
+
+    // Runs tasks until all tasks submitted with counter are done
+    void wait(Counter& counter);
+
+    // Calls func(begin, end) for ranges that cover [0, count) and returns when all of them are
+    // done. There are just enough ranges to give every thread a few of them, but they are at least
+    // grain_size long (except the last one), so small counts only run on this thread.
+    template <typename Func>
+    void parallel_for(usize count, usize grain_size, Func&& func)
+    {
+        grain_size = std::max<usize>(grain_size, 1);
+        const auto num_ranges = std::min((count + grain_size - 1) / grain_size, 4 * num_threads());
+        if (num_ranges <= 1 || num_threads() == 1) {
+            if (count > 0) {
+                func(usize(0), count);
+            }
+            return;
+        }
+
+        const auto range_size = (count + num_ranges - 1) / num_ranges;
+        Counter counter = 0;
+        for (usize begin = range_size; begin < count; begin += range_size) {
+            const auto end = std::min(begin + range_size, count);
+            submit(counter, [&func, begin, end] { func(begin, end); });
+        }
+        func(usize(0), range_size);
+        wait(counter);
+    }
+
+private:
+    struct Entry {
+        Task task;
+        Counter* counter = nullptr;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Entry> entries;
+    };
+
+    void start_workers();
+    void work(usize index);
+    bool run_one(usize index);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::once_flag started_;
+    // Tasks in all queues, so workers know when to sleep
+    std::atomic<usize> num_queued_ = 0;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+};
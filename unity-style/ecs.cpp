@@ -3,10 +3,10 @@
 #include <vector>
 
 namespace detail {
-ComponentId& get_component_id_counter()
+std::vector<GameObjectId>& marked_for_destruction()
 {
-    static ComponentId component_id_counter = 0;
-    return component_id_counter;
+    static std::vector<GameObjectId> ids;
+    return ids;
 }
 }
 
@@ -31,16 +31,14 @@ GameObject* get_game_object(GameObjectId id)
 
 void destroy_marked_for_destruction()
 {
-    auto& objs = game_objects();
-    std::vector<GameObjectId> ids;
-    auto id = objs.next({});
-    while (id) {
-        if (objs.get(id)->marked_for_destruction()) {
-            ids.push_back(id);
-        }
-        id = objs.next(id);
-    }
+    // Swapped out, so components that mark other game objects when they are destroyed don't change
+    // the list while it is used (they are removed by the next call)
+    static std::vector<GameObjectId> ids;
+    std::swap(ids, detail::marked_for_destruction());
     for (const auto id : ids) {
-        objs.remove(id);
+        if (game_objects().get(id)) {
+            game_objects().remove(id);
+        }
     }
-}
\ No newline at end of file
+    ids.clear();
+}
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
 #include <memory>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <fmt/format.h>
@@ -18,19 +21,43 @@ using GameObjectSlotMap = pasta::SlotMap<T, GameObjectStorage, Key>;
 using ComponentId = u32;
 constexpr usize MaxComponents = 12;
 
-namespace detail {
-ComponentId& get_component_id_counter();
-}
-
 struct GameObjectTag { };
 using GameObjectId = pasta::CompositeId<GameObjectTag>;
 
+// The components of the game, which get the ids 0, 1, 2, ... in the order of the list with
+// COMPONENT_LIST. The ids are constant, so getting a component is a load from a fixed offset.
+template <typename... Ts>
+struct ComponentList {
+    template <typename T>
+    static constexpr bool contains = (std::is_same_v<T, Ts> || ...);
+
+    template <typename T>
+        requires contains<T>
+    static constexpr ComponentId index = [] {
+        ComponentId idx = 0;
+        ((std::is_same_v<T, Ts> ? false : (idx++, true)) && ...);
+        return idx;
+    }();
+
+    static_assert(sizeof...(Ts) <= MaxComponents);
+};
+
+// Only defined for the components in the list
 template <typename T>
-ComponentId component_id()
+struct ComponentIndex;
+
+// Has to be used in the global namespace, before the components are used
+#define COMPONENT_LIST(List)                                                                       \
+    template <typename T>                                                                          \
+        requires(List::template contains<T>)                                                       \
+    struct ComponentIndex<T> {                                                                     \
+        static constexpr ComponentId value = List::template index<T>;                              \
+    }
+
+template <typename T>
+constexpr ComponentId component_id()
 {
-    static auto id = detail::get_component_id_counter()++;
-    assert(id < MaxComponents);
-    return id;
+    return ComponentIndex<T>::value;
 }
 
 // Real version could use a variant and dispatch on it
@@ -41,6 +68,9 @@ struct CollisionEvent {
 
 struct GameObject;
 
+template <typename T>
+class ComponentPool;
+
 struct Component {
     GameObject* parent = nullptr;
 
@@ -54,34 +84,145 @@ struct Component {
 
     template <typename T>
     T* try_get_component();
+
+private:
+    template <typename T>
+    friend class ComponentPool;
+
+    usize pool_idx_ = 0; // In the list of all components of its type
+};
+
+// Every component type has its own pool, which allocates pages of PageSize components, so
+// components of the same type are next to each other in memory (in the order they were created,
+// unless some were freed in between) instead of being spread over the heap. Components never move,
+// so pointers to them stay valid. Freed slots are put in a free list and reused first.
+// The pool also keeps a dense list of all components of its type, so update<T> doesn't have to look
+// at every game object.
+template <typename T>
+class ComponentPool {
+public:
+    static constexpr usize PageSize = 1024;
+
+    // Never destroyed, because game objects with components from it might be destroyed later
+    // (e.g. the ones in game_objects() at exit)
+    static ComponentPool& instance()
+    {
+        static auto pool = new ComponentPool;
+        return *pool;
+    }
+
+    template <typename... Args>
+    T* create(Args&&... args)
+    {
+        if (!free_) {
+            add_page();
+        }
+        auto slot = free_;
+        free_ = slot->next;
+        const auto comp = new (slot->storage) T(std::forward<Args>(args)...);
+        comp->pool_idx_ = components_.size();
+        components_.push_back(comp);
+        return comp;
+    }
+
+    void destroy(T* comp)
+    {
+        // Move the last component to its place in the list
+        const auto last = components_.back();
+        components_[comp->pool_idx_] = last;
+        last->pool_idx_ = comp->pool_idx_;
+        components_.pop_back();
+
+        comp->~T();
+        auto slot = reinterpret_cast<Slot*>(comp);
+        slot->next = free_;
+        free_ = slot;
+    }
+
+    usize size() const { return components_.size(); }
+
+    // In no particular order
+    T* operator[](usize idx) const { return components_[idx]; }
+
+private:
+    union Slot {
+        Slot* next;
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+
+    ComponentPool() = default;
+
+    void add_page()
+    {
+        auto& page = pages_.emplace_back(std::make_unique<Slot[]>(PageSize));
+        for (usize i = 0; i + 1 < PageSize; ++i) {
+            page[i].next = &page[i + 1];
+        }
+        page[PageSize - 1].next = free_;
+        free_ = &page[0];
+    }
+
+    std::vector<std::unique_ptr<Slot[]>> pages_;
+    Slot* free_ = nullptr;
+    std::vector<T*> components_;
 };
 
+namespace detail {
+using DestroyComponent = void (*)(Component*);
+
+// Returns a component to the pool of its type. add_component sets the function for its type.
+inline std::array<DestroyComponent, MaxComponents> destroy_component {};
+
+// The game objects that destroy was called on, which destroy_marked_for_destruction removes
+std::vector<GameObjectId>& marked_for_destruction();
+}
+
 class GameObject {
 public:
     GameObjectId id;
 
     GameObject() { }
 
-    GameObject(GameObject&&) = default;
-    GameObject& operator=(GameObject&&) = default;
+    GameObject(GameObject&& other)
+        : id(other.id)
+        , components_(std::exchange(other.components_, {}))
+        , marked_for_destruction_(other.marked_for_destruction_)
+    {
+        set_parents();
+    }
+
+    GameObject& operator=(GameObject&& other)
+    {
+        if (this != &other) {
+            destroy_components();
+            id = other.id;
+            components_ = std::exchange(other.components_, {});
+            marked_for_destruction_ = other.marked_for_destruction_;
+            set_parents();
+        }
+        return *this;
+    }
+
+    ~GameObject() { destroy_components(); }
 
     template <typename T, typename... Args>
     T& add_component(Args&&... args)
     {
-        const auto id = component_id<T>();
-        assert(id < components_.size());
+        constexpr auto id = component_id<T>();
         assert(!components_[id]);
-        components_[id] = std::make_unique<T>(std::forward<Args>(args)...);
-        components_[id]->parent = this;
-        return *static_cast<T*>(components_[id].get());
+        auto comp = ComponentPool<T>::instance().create(std::forward<Args>(args)...);
+        detail::destroy_component[id]
+            = [](Component* comp) { ComponentPool<T>::instance().destroy(static_cast<T*>(comp)); };
+        comp->parent = this;
+        components_[id] = comp;
+        return *comp;
     }
 
     template <typename T>
     T* try_get_component()
     {
-        const auto id = component_id<T>();
-        assert(id < components_.size());
-        return static_cast<T*>(components_[id].get());
+        constexpr auto id = component_id<T>();
+        return static_cast<T*>(components_[id]);
     }
 
     template <typename T>
@@ -95,15 +236,17 @@ public:
     template <typename T>
     void remove_component()
     {
-        const auto id = component_id<T>();
-        assert(id < components_.size());
-        components_[id].reset();
+        constexpr auto id = component_id<T>();
+        if (components_[id]) {
+            ComponentPool<T>::instance().destroy(static_cast<T*>(components_[id]));
+            components_[id] = nullptr;
+        }
     }
 
     template <typename Event>
     void send(const Event& event)
     {
-        for (auto& comp : components_) {
+        for (auto comp : components_) {
             if (comp) {
                 comp->on(event);
             }
@@ -111,10 +254,37 @@ public:
     }
 
     bool marked_for_destruction() const { return marked_for_destruction_; }
-    void destroy() { marked_for_destruction_ = true; }
+
+    void destroy()
+    {
+        if (!marked_for_destruction_) {
+            marked_for_destruction_ = true;
+            detail::marked_for_destruction().push_back(id);
+        }
+    }
 
 private:
-    std::array<std::unique_ptr<Component>, MaxComponents> components_ {};
+    // The components point back to their game object
+    void set_parents()
+    {
+        for (auto comp : components_) {
+            if (comp) {
+                comp->parent = this;
+            }
+        }
+    }
+
+    void destroy_components()
+    {
+        for (ComponentId id = 0; id < MaxComponents; ++id) {
+            if (components_[id]) {
+                detail::destroy_component[id](components_[id]);
+            }
+        }
+    }
+
+    // Owned, allocated from the pools of their types
+    std::array<Component*, MaxComponents> components_ {};
     bool marked_for_destruction_ = false;
 };
 
@@ -135,14 +305,18 @@ void for_each_game_object(Func func)
     destroy_marked_for_destruction();
 }
 
+// Only visits the components of type C (not every game object) and calls C::update directly
+// instead of through the vtable, so it can be inlined. Components of type C that are created
+// during the loop are updated too, but none may be removed (game objects are only marked for
+// destruction until the loop is done).
 template <typename C>
 static void update(float dt)
 {
-    for_each_game_object([dt](GameObjectId, GameObject& obj) {
-        if (auto comp = obj.try_get_component<C>(); comp) {
-            comp->update(dt);
-        }
-    });
+    auto& pool = ComponentPool<C>::instance();
+    for (usize i = 0; i < pool.size(); ++i) {
+        pool[i]->C::update(dt);
+    }
+    destroy_marked_for_destruction();
 }
 
 template <typename T>